@@ -39,6 +39,9 @@ static size_t sram_size = 0;
 static uint8_t chr_ram[1024 * 256] = {0};
 
 static uint32_t core_pixels[NES_SCREEN_HEIGHT][NES_SCREEN_WIDTH];
+// a frame's worth of samples, enough for up to ~240khz
+static int16_t core_samples[4096];
+static int audio_freq = 0;
 
 static bool running = true;
 static int scale = 2;
@@ -62,11 +65,35 @@ static int get_scale(int w, int h)
     return scale_w < scale_h ? scale_w : scale_h;
 }
 
+static void queue_audio(uint32_t count)
+{
+    int16_t samples[ARRAY_SIZE(core_samples)] = {0};
+    const uint32_t size = count * sizeof(int16_t);
+
+    SDL_MixAudioFormat((uint8_t*)samples, (const uint8_t*)core_samples, AUDIO_S16SYS, size, VOLUME);
+
+    while (SDL_GetQueuedAudioSize(audio_device) > (SAMPLES * sizeof(int16_t) * 4))
+    {
+        SDL_Delay(8);
+    }
+
+    SDL_QueueAudio(audio_device, samples, size);
+}
+
+static void set_speed(int new_speed)
+{
+    speed = new_speed;
+
+    // if speedup is enabled, sample at a lower rate in order to not fill
+    // the audio buffer!
+    NES_set_audio_buffer(&nes, core_samples, ARRAY_SIZE(core_samples), NES_AUDIO_FORMAT_S16, 1, audio_freq / speed);
+}
+
 static void run()
 {
     for (int i = 0; i < speed; ++i)
     {
-        NES_run_frame(&nes);
+        queue_audio(NES_run_frame(&nes));
     }
 }
 
@@ -146,7 +173,7 @@ static void on_ctrl_key_event(const SDL_KeyboardEvent* e, bool down)
             case SDL_SCANCODE_7:
             case SDL_SCANCODE_8:
             case SDL_SCANCODE_9:
-                speed = (e->keysym.scancode - SDL_SCANCODE_1) + 1;
+                set_speed((e->keysym.scancode - SDL_SCANCODE_1) + 1);
                 break;
 
             case SDL_SCANCODE_F:
@@ -340,63 +367,52 @@ static void events()
     } 
 }
 
-static void core_on_apu(void* user, struct NES_ApuCallbackData* data)
+static bool is_row_dirty(const struct NES_FrameDiff* diff, int y)
+{
+    return (diff->rows[y >> 5] >> (y & 31)) & 1;
+}
+
+static void core_on_vblank(void* user)
 {
     (void)user;
 
-    // using buffers because pushing 1 sample at a time seems to
-    // cause popping sounds (on my chromebook).
-    static int8_t buffer[SAMPLES] = {0};
+    // rows changed in skipped frames still need to be uploaded,
+    // so the diffs are merged until the texture is updated.
+    static struct NES_FrameDiff pending = {0};
 
-    static size_t buffer_count = 0;
+    const struct NES_FrameDiff* diff = NES_get_frame_diff(&nes);
 
-    // if speedup is enabled, skip x many samples in order to not fill the audio buffer!
-    if (speed > 1)
+    for (size_t i = 0; i < ARRAY_SIZE(pending.rows); ++i)
     {
-        static int skipped_samples = 0;
-
-        if (skipped_samples < speed - 1)
-        {
-            ++skipped_samples;
-            return;
-        }     
-
-        skipped_samples = 0;   
+        pending.rows[i] |= diff->rows[i];
     }
 
-    buffer[buffer_count++] = data->square1 + data->square2 + data->triangle + data->noise;
+    ++frameskip_counter;
 
-    if (buffer_count == sizeof(buffer))
+    if (frameskip_counter >= speed)
     {
-        buffer_count = 0;
-
-        uint8_t samples[sizeof(buffer)] = {0};
-
-        SDL_MixAudioFormat(samples, (const uint8_t*)buffer, AUDIO_S8, sizeof(buffer), VOLUME);
-
-        while (SDL_GetQueuedAudioSize(audio_device) > (sizeof(buffer) * 4))
+        // only upload the runs of rows that changed
+        for (int y = 0; y < HEIGHT;)
         {
-            SDL_Delay(8);
-        }
-
-        SDL_QueueAudio(audio_device, samples, sizeof(samples));
-    }
-}
+            if (!is_row_dirty(&pending, y))
+            {
+                ++y;
+                continue;
+            }
 
-static void core_on_vblank(void* user)
-{
-    (void)user;
+            const int start = y;
 
-    ++frameskip_counter;
+            while (y < HEIGHT && is_row_dirty(&pending, y))
+            {
+                ++y;
+            }
 
-    if (frameskip_counter >= speed)
-    {
-        void* pixels; int pitch;
+            const SDL_Rect area = { .x = 0, .y = start, .w = WIDTH, .h = y - start };
 
-        SDL_LockTexture(texture, NULL, &pixels, &pitch);
-        memcpy(pixels, core_pixels, sizeof(core_pixels));
-        SDL_UnlockTexture(texture);
+            SDL_UpdateTexture(texture, &area, core_pixels[start], sizeof(core_pixels[0]));
+        }
 
+        memset(&pending, 0, sizeof(pending));
         frameskip_counter = 0;
     }
 }
@@ -432,6 +448,10 @@ static void setup_palette()
         palette.colour[i] = SDL_MapRGB(pixel_format, rgb.r, rgb.g, rgb.b);
     }
 
+    palette.rmask = pixel_format->Rmask;
+    palette.gmask = pixel_format->Gmask;
+    palette.bmask = pixel_format->Bmask;
+
     NES_set_palette(&nes, &palette);
 }
 
@@ -513,7 +533,7 @@ int main(int argc, char** argv)
     const SDL_AudioSpec wanted =
     {
         .freq = SDL_AUDIO_FREQ,
-        .format = AUDIO_S8,
+        .format = AUDIO_S16SYS,
         .channels = 1,
         .silence = 0,
         .samples = SAMPLES,
@@ -543,7 +563,8 @@ int main(int argc, char** argv)
 
     NES_set_chr_ram(&nes, chr_ram, sizeof(chr_ram));
     NES_set_pixels(&nes, core_pixels, NES_SCREEN_WIDTH, 32);
-    NES_set_apu_callback(&nes, core_on_apu, NULL, aspec_got.freq + 512);
+    audio_freq = aspec_got.freq + 512;
+    set_speed(speed);
     NES_set_vblank_callback(&nes, core_on_vblank, NULL);
 
     struct NES_RomInfo rom_info = {0};
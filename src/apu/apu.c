@@ -1,6 +1,7 @@
 #include "../nes.h"
 #include "../internal.h"
 #include "apu.h"
+#include "../tables/mixer_table.h"
 
 #include <assert.h>
 
@@ -28,14 +29,12 @@ const uint16_t NOISE_TIMER_TABLE[0x10] =
 };
 
 // this is the volume for the triangle
-// the table isn't accurate yet, just oprox, need to correct it more
-// for signed values
-const int8_t TRIANGLE_DUTY_TABLE[0x20] =
-{
-    -7, -6, -5, -4, -3, -2, -1, -0,
-    +1, +2, +3, +4, +5, +6, +7, +8,
-    +8, +7, +6, +5, +4, +3, +2, +1,
-    +0, -1, -2, -3, -4, -5, -6, -7
+const uint8_t TRIANGLE_DUTY_TABLE[0x20] =
+{
+    15, 14, 13, 12, 11, 10,  9,  8,
+     7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,
+     8,  9, 10, 11, 12, 13, 14, 15,
 };
 
 static FORCE_INLINE void on_clock_irq(struct NES_Core* nes)
@@ -129,79 +128,252 @@ static FORCE_INLINE void frame_sequencer_clock(struct NES_Core* nes)
     }
 }
 
-static FORCE_INLINE void sample(struct NES_Core* nes)
+// mixes a side with the gain (256 = full) of each channel, the levels
+// are scaled then rounded to the nearest table entry.
+static FORCE_INLINE int32_t mix_panned(const uint8_t* level, const uint16_t* gain)
+{
+    const uint32_t pulse =
+        (level[NES_AUDIO_CHANNEL_SQUARE1] * gain[NES_AUDIO_CHANNEL_SQUARE1]) +
+        (level[NES_AUDIO_CHANNEL_SQUARE2] * gain[NES_AUDIO_CHANNEL_SQUARE2]);
+
+    const uint32_t tnd =
+        (level[NES_AUDIO_CHANNEL_TRIANGLE] * gain[NES_AUDIO_CHANNEL_TRIANGLE] * 3) +
+        (level[NES_AUDIO_CHANNEL_NOISE] * gain[NES_AUDIO_CHANNEL_NOISE] * 2);
+
+    return MIXER_PULSE_TABLE[(pulse + 128) >> 8] + MIXER_TND_TABLE[(tnd + 128) >> 8];
+}
+
+static FORCE_INLINE void add_output(struct NES_Core* nes, uint8_t side, uint32_t time, int32_t amp)
+{
+    if (amp != nes->audio_amp[side])
+    {
+        nes_blip_add_delta(&nes->blip[side], time, amp - nes->audio_amp[side]);
+        nes->audio_amp[side] = amp;
+    }
+}
+
+// adds a delta to the blip buffer if the output changed, time being the
+// cpu cycle in the current run that it changed at.
+static FORCE_INLINE void update_output(struct NES_Core* nes, uint32_t time)
 {
-    struct NES_ApuCallbackData data =
+    if (!nes->audio_buffer)
     {
-        .square1    = sample_square1(nes)   * is_square1_enabled(nes),
-        .square2    = sample_square2(nes)   * is_square2_enabled(nes),
-        .triangle   = sample_triangle(nes)  * is_triangle_enabled(nes),
-        .noise      = sample_noise(nes)     * is_noise_enabled(nes),
+        return;
+    }
+
+    // the 4-bit output level of each channel
+    const uint8_t level[NES_AUDIO_CHANNEL_COUNT] =
+    {
+        [NES_AUDIO_CHANNEL_SQUARE1]     = sample_square1(nes)   * is_square1_enabled(nes),
+        [NES_AUDIO_CHANNEL_SQUARE2]     = sample_square2(nes)   * is_square2_enabled(nes),
+        [NES_AUDIO_CHANNEL_TRIANGLE]    = sample_triangle(nes)  * is_triangle_enabled(nes),
+        [NES_AUDIO_CHANNEL_NOISE]       = sample_noise(nes)     * is_noise_enabled(nes),
     };
 
-    nes->apu_callback(nes->apu_callback_user, &data);
+    const uint32_t at = nes->audio_time + time;
+
+    if (LIKELY(!nes->audio_panned))
+    {
+        const int32_t amp =
+            MIXER_PULSE_TABLE[level[NES_AUDIO_CHANNEL_SQUARE1] + level[NES_AUDIO_CHANNEL_SQUARE2]] +
+            MIXER_TND_TABLE[(level[NES_AUDIO_CHANNEL_TRIANGLE] * 3) + (level[NES_AUDIO_CHANNEL_NOISE] * 2)];
+
+        add_output(nes, 0, at, amp);
+    }
+    else
+    {
+        add_output(nes, 0, at, mix_panned(level, nes->audio_gain[0]));
+        add_output(nes, 1, at, mix_panned(level, nes->audio_gain[1]));
+    }
 }
 
-void nes_apu_run(struct NES_Core* nes, const uint16_t cycles_elapsed)
+// runs the apu for the cycles, stepping from one timer running out to
+// the next so that the output changes in order.
+static void apu_run(struct NES_Core* nes, uint32_t cycles)
 {
-    if (SQUARE1_CHANNEL.timer > 0 || get_square1_freq(nes))
+    // register writes since the last run may have changed the output
+    update_output(nes, 0);
+
+    // the channel timers only change the output, so are left alone if
+    // nothing is listening. the frame sequencer has to keep going for
+    // the length counters and status.
+    const bool audio = nes->audio_buffer != NULL;
+
+    uint32_t now = 0;
+
+    for (;;)
     {
-        SQUARE1_CHANNEL.timer -= cycles_elapsed;
-        if (SQUARE1_CHANNEL.timer <= 0)
+        // a period of 0 means the timer is stopped once it runs out
+        const uint16_t square1_period = get_square1_freq(nes) << 1;
+        const uint16_t square2_period = get_square2_freq(nes) << 1;
+        const uint16_t triangle_period = get_triangle_freq(nes);
+        const uint16_t noise_period = get_noise_freq(nes);
+
+        const bool square1_on = audio && (SQUARE1_CHANNEL.timer > 0 || square1_period);
+        const bool square2_on = audio && (SQUARE2_CHANNEL.timer > 0 || square2_period);
+        const bool triangle_on = audio && (TRIANGLE_CHANNEL.timer > 0 || triangle_period);
+        const bool noise_on = audio && (NOISE_CHANNEL.timer > 0 || noise_period);
+
+        int32_t next = FRAME_SEQUENCER.timer;
+
+        if (square1_on && SQUARE1_CHANNEL.timer < next) { next = SQUARE1_CHANNEL.timer; }
+        if (square2_on && SQUARE2_CHANNEL.timer < next) { next = SQUARE2_CHANNEL.timer; }
+        if (triangle_on && TRIANGLE_CHANNEL.timer < next) { next = TRIANGLE_CHANNEL.timer; }
+        if (noise_on && NOISE_CHANNEL.timer < next) { next = NOISE_CHANNEL.timer; }
+
+        next = next < 0 ? 0 : next;
+
+        // nothing else runs out before the end
+        const bool done = now + next > cycles;
+
+        if (done)
+        {
+            next = cycles - now;
+        }
+
+        now += next;
+
+        if (square1_on) { SQUARE1_CHANNEL.timer -= next; }
+        if (square2_on) { SQUARE2_CHANNEL.timer -= next; }
+        if (triangle_on) { TRIANGLE_CHANNEL.timer -= next; }
+        if (noise_on) { NOISE_CHANNEL.timer -= next; }
+        FRAME_SEQUENCER.timer -= next;
+
+        if (done)
+        {
+            break;
+        }
+
+        if (square1_on && square1_period && SQUARE1_CHANNEL.timer <= 0)
         {
-            SQUARE1_CHANNEL.timer += get_square1_freq(nes) << 1;
             clock_square1_duty(nes);
+            SQUARE1_CHANNEL.timer += square1_period;
         }
-    }
 
-    if (SQUARE2_CHANNEL.timer > 0 || get_square2_freq(nes))
-    {
-        SQUARE2_CHANNEL.timer -= cycles_elapsed;
-        if (SQUARE2_CHANNEL.timer <= 0)
+        if (square2_on && square2_period && SQUARE2_CHANNEL.timer <= 0)
         {
-            SQUARE2_CHANNEL.timer += get_square2_freq(nes) << 1;
             clock_square2_duty(nes);
+            SQUARE2_CHANNEL.timer += square2_period;
         }
-    }
 
-    if (TRIANGLE_CHANNEL.timer > 0 || get_triangle_freq(nes))
-    {
-        TRIANGLE_CHANNEL.timer -= cycles_elapsed;
-        if (TRIANGLE_CHANNEL.timer <= 0)
+        if (triangle_on && triangle_period && TRIANGLE_CHANNEL.timer <= 0)
         {
-            TRIANGLE_CHANNEL.timer += get_triangle_freq(nes);
             clock_triangle_duty(nes);
+            TRIANGLE_CHANNEL.timer += triangle_period;
         }
+
+        if (noise_on && noise_period && NOISE_CHANNEL.timer <= 0)
+        {
+            clock_noise_lsfr(nes);
+            NOISE_CHANNEL.timer += noise_period;
+        }
+
+        if (FRAME_SEQUENCER.timer <= 0)
+        {
+            frame_sequencer_clock(nes);
+            FRAME_SEQUENCER.timer += APU_FRAME_SEQUENCER_STEP_RATE << 1;
+        }
+
+        update_output(nes, now);
+    }
+
+    nes->audio_time += cycles;
+
+    // only happens if NES_step() is used with the ppu not reaching vblank
+    if (UNLIKELY(nes->audio_time >= CPU_CYCLES_PER_FRAME * 2))
+    {
+        nes_apu_end_frame(nes);
+    }
+}
+
+void nes_apu_sync(struct NES_Core* nes)
+{
+    if (nes->apu.lag)
+    {
+        const uint32_t cycles = nes->apu.lag;
+
+        // cleared first as the run may end the frame, which syncs
+        nes->apu.lag = 0;
+        apu_run(nes, cycles);
     }
+}
 
-    if (NOISE_CHANNEL.timer > 0 || get_noise_freq(nes))
+// writes the samples from each side into the buffer in its format
+static void write_samples(struct NES_Core* nes, uint32_t offset, const int16_t* left, const int16_t* right, uint32_t count)
+{
+    const uint8_t channels = nes->audio_channels;
+
+    if (nes->audio_format == NES_AUDIO_FORMAT_F32)
     {
-        NOISE_CHANNEL.timer -= cycles_elapsed;
-        if (NOISE_CHANNEL.timer <= 0)
+        float* out = (float*)nes->audio_buffer + (offset * channels);
+
+        for (uint32_t i = 0; i < count; ++i)
         {
-            NOISE_CHANNEL.timer += get_noise_freq(nes);
-            clock_noise_lsfr(nes);
+            out[i * channels] = left[i] * (1.0f / 32768.0f);
+
+            if (channels == 2)
+            {
+                out[(i * 2) + 1] = right[i] * (1.0f / 32768.0f);
+            }
         }
     }
+    else
+    {
+        int16_t* out = (int16_t*)nes->audio_buffer + (offset * channels);
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            out[i * channels] = left[i];
 
-    APU.frame_sequencer.timer -= cycles_elapsed;
-    
-    while (APU.frame_sequencer.timer <= 0)
+            if (channels == 2)
+            {
+                out[(i * 2) + 1] = right[i];
+            }
+        }
+    }
+}
+
+void nes_apu_end_frame(struct NES_Core* nes)
+{
+    if (!nes->audio_buffer)
     {
-        APU.frame_sequencer.timer += APU_FRAME_SEQUENCER_STEP_RATE << 1;
-        frame_sequencer_clock(nes);
+        return;
     }
 
-    // only tick if the user has provided a sample callback
-    if (nes->apu_callback && nes->apu_callback_freq)
+    nes_apu_sync(nes);
+
+    const uint8_t sides = nes->audio_panned ? 2 : 1;
+
+    for (uint8_t i = 0; i < sides; ++i)
     {
-        nes->apu_callback_counter -= cycles_elapsed;
+        nes_blip_end_frame(&nes->blip[i], nes->audio_time);
+    }
+
+    nes->audio_time = 0;
+
+    // read out in chunks, anything that doesn't fit is dropped
+    uint32_t space = nes->audio_buffer_size - nes->audio_count;
+    int16_t samples[2][256];
+
+    while (space && nes->blip[0].avail)
+    {
+        const uint32_t count = nes_blip_read(&nes->blip[0], samples[0], space < 256 ? space : 256);
 
-        if (nes->apu_callback_counter <= 0)
+        // if not panned, right is the same as left
+        if (sides == 2)
         {
-            nes->apu_callback_counter += (CPU_CLOCK / nes->apu_callback_freq);
-            sample(nes);
+            nes_blip_read(&nes->blip[1], samples[1], count);
         }
+
+        write_samples(nes, nes->audio_count, samples[0], samples[sides - 1], count);
+
+        nes->audio_count += count;
+        space -= count;
+    }
+
+    for (uint8_t i = 0; i < sides; ++i)
+    {
+        nes_blip_read(&nes->blip[i], NULL, NES_BLIP_SIZE);
     }
 }
 
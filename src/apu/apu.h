@@ -23,7 +23,7 @@ extern "C" {
 extern const bool SQUARE_DUTY[4][8];
 extern const uint8_t LENGTH_COUNTER_TABLE[0x20];
 extern const uint16_t NOISE_TIMER_TABLE[0x10];
-extern const int8_t TRIANGLE_DUTY_TABLE[0x20];
+extern const uint8_t TRIANGLE_DUTY_TABLE[0x20];
 
 
 // [SQUARE1 - PULSE1]
@@ -34,7 +34,7 @@ NES_FORCE_INLINE void clock_square1_length(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_square1_envelope(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_square1_sweep(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_square1_duty(struct NES_Core* nes);
-NES_FORCE_INLINE int8_t sample_square1(const struct NES_Core* nes);
+NES_FORCE_INLINE uint8_t sample_square1(const struct NES_Core* nes);
 
 
 // [SQUARE2 - PULSE2]
@@ -45,7 +45,7 @@ NES_FORCE_INLINE void clock_square2_length(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_square2_envelope(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_square2_sweep(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_square2_duty(struct NES_Core* nes);
-NES_FORCE_INLINE int8_t sample_square2(const struct NES_Core* nes);
+NES_FORCE_INLINE uint8_t sample_square2(const struct NES_Core* nes);
 
 
 // [TRIANGLE]
@@ -55,7 +55,7 @@ NES_FORCE_INLINE uint16_t get_triangle_freq(const struct NES_Core* nes);
 NES_FORCE_INLINE void clock_triangle_length(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_triangle_linear(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_triangle_duty(struct NES_Core* nes);
-NES_FORCE_INLINE int8_t sample_triangle(const struct NES_Core* nes);
+NES_FORCE_INLINE uint8_t sample_triangle(const struct NES_Core* nes);
 
 
 // [NOISE]
@@ -65,7 +65,7 @@ NES_FORCE_INLINE uint16_t get_noise_freq(const struct NES_Core* nes);
 NES_FORCE_INLINE void clock_noise_length(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_noise_envelope(struct NES_Core* nes);
 NES_FORCE_INLINE void clock_noise_lsfr(struct NES_Core* nes);
-NES_FORCE_INLINE int8_t sample_noise(const struct NES_Core* nes);
+NES_FORCE_INLINE uint8_t sample_noise(const struct NES_Core* nes);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,132 @@
+#include "../nes.h"
+#include "../internal.h"
+#include "../tables/blip_table.h"
+
+#include <string.h>
+
+
+// band-limited step synthesis. instead of point sampling the channels,
+// each change in output is added as a delta at the cpu cycle it happened,
+// spread over a few output samples using a step from BLIP_STEP_TABLE.
+// the output is then the running sum of the deltas, which is done in
+// one pass once the frame is done.
+//
+// time is kept in output samples as 32.32 fixed point.
+
+enum
+{
+    BLIP_FRAC_BITS = 32,
+    // phases in the step table (5 bits of the fraction)
+    BLIP_PHASE_BITS = 5,
+    // the rest of the fraction is used to blend between 2 phases
+    BLIP_DELTA_BITS = 15,
+    // high pass, removes dc at around freq / (2 * pi * 512)
+    BLIP_BASS_SHIFT = 9,
+};
+
+void nes_blip_clear(struct NES_Blip* blip)
+{
+    // start half a sample in so that rounding is to the nearest
+    blip->offset = blip->factor / 2;
+    blip->avail = 0;
+    blip->integrator = 0;
+    memset(blip->buf, 0, sizeof(blip->buf));
+}
+
+void nes_blip_set_rate(struct NES_Blip* blip, uint32_t freq)
+{
+    blip->factor = ((uint64_t)freq << BLIP_FRAC_BITS) / CPU_CLOCK;
+    nes_blip_clear(blip);
+}
+
+void nes_blip_add_delta(struct NES_Blip* blip, uint32_t time, int32_t delta)
+{
+    const uint64_t fixed = (time * blip->factor) + blip->offset;
+    const uint32_t index = blip->avail + (uint32_t)(fixed >> BLIP_FRAC_BITS);
+
+    // only happens if the frame wasn't ended for far too long
+    if (index >= NES_BLIP_SIZE)
+    {
+        return;
+    }
+
+    const uint32_t phase = (fixed >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & ((1 << BLIP_PHASE_BITS) - 1);
+    const int32_t interp = (fixed >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS - BLIP_DELTA_BITS)) & ((1 << BLIP_DELTA_BITS) - 1);
+
+    // the delta is split between this phase and the next
+    const int32_t delta2 = (delta * interp) >> BLIP_DELTA_BITS;
+    const int32_t delta1 = delta - delta2;
+
+    const int16_t* in = BLIP_STEP_TABLE[phase];
+    const int16_t* next = BLIP_STEP_TABLE[phase + 1];
+    int32_t* out = blip->buf + index;
+
+    for (uint8_t i = 0; i < NES_BLIP_TAPS; ++i)
+    {
+        out[i] += (in[i] * delta1) + (next[i] * delta2);
+    }
+}
+
+void nes_blip_end_frame(struct NES_Blip* blip, uint32_t time)
+{
+    const uint64_t off = (time * blip->factor) + blip->offset;
+
+    blip->avail += (uint32_t)(off >> BLIP_FRAC_BITS);
+    blip->offset = off & UINT32_MAX;
+
+    if (blip->avail > NES_BLIP_SIZE)
+    {
+        blip->avail = NES_BLIP_SIZE;
+    }
+}
+
+uint32_t nes_blip_read(struct NES_Blip* blip, int16_t* out, uint32_t count)
+{
+    if (count > blip->avail)
+    {
+        count = blip->avail;
+    }
+
+    if (out)
+    {
+        int32_t sum = blip->integrator;
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            int32_t s = sum >> BLIP_DELTA_BITS;
+            sum += blip->buf[i];
+
+            if (s > INT16_MAX)
+            {
+                s = INT16_MAX;
+            }
+            else if (s < INT16_MIN)
+            {
+                s = INT16_MIN;
+            }
+
+            out[i] = (int16_t)s;
+            sum -= s * (1 << (BLIP_DELTA_BITS - BLIP_BASS_SHIFT));
+        }
+
+        blip->integrator = sum;
+    }
+    else
+    {
+        // still have to keep the running sum going
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const int32_t s = blip->integrator >> BLIP_DELTA_BITS;
+            blip->integrator += blip->buf[i];
+            blip->integrator -= s * (1 << (BLIP_DELTA_BITS - BLIP_BASS_SHIFT));
+        }
+    }
+
+    // move the rest of the frame (and the tail of the last steps) down
+    const uint32_t remain = blip->avail - count + NES_BLIP_TAPS;
+    memmove(blip->buf, blip->buf + count, remain * sizeof(blip->buf[0]));
+    memset(blip->buf + remain, 0, count * sizeof(blip->buf[0]));
+    blip->avail -= count;
+
+    return count;
+}
@@ -78,9 +78,9 @@ void clock_noise_lsfr(struct NES_Core* nes) {
     NOISE_CHANNEL.lsfr |= ord_bit << 14;
 }
 
-int8_t sample_noise(const struct NES_Core* nes) {
+uint8_t sample_noise(const struct NES_Core* nes) {
     if (NOISE_CHANNEL.length_counter == 0) {
-        return -NOISE_CHANNEL.volume;
+        return 0;
     }
 
     // this is actually the inverse.
@@ -90,7 +90,7 @@ int8_t sample_noise(const struct NES_Core* nes) {
         return NOISE_CHANNEL.volume;
     }
 
-    return -NOISE_CHANNEL.volume;
+    return 0;
 }
 
 
@@ -123,11 +123,11 @@ void clock_square1_duty(struct NES_Core* nes)
     SQUARE1_CHANNEL.duty_index &= 0x7;
 }
 
-int8_t sample_square1(const struct NES_Core* nes)
+uint8_t sample_square1(const struct NES_Core* nes)
 {
     if (SQUARE1_CHANNEL.length_counter == 0)
     {
-        return -SQUARE1_CHANNEL.volume;
+        return 0;
     }
 
     if (SQUARE_DUTY[SQUARE1_CHANNEL.duty][SQUARE1_CHANNEL.duty_index])
@@ -135,5 +135,5 @@ int8_t sample_square1(const struct NES_Core* nes)
         return SQUARE1_CHANNEL.volume;
     }
 
-    return -SQUARE1_CHANNEL.volume;
+    return 0;
 }
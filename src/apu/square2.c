@@ -123,11 +123,11 @@ void clock_square2_duty(struct NES_Core* nes)
     SQUARE2_CHANNEL.duty_index &= 0x7;
 }
 
-int8_t sample_square2(const struct NES_Core* nes)
+uint8_t sample_square2(const struct NES_Core* nes)
 {
     if (SQUARE2_CHANNEL.length_counter == 0)
     {
-        return -SQUARE2_CHANNEL.volume;
+        return 0;
     }
 
     if (SQUARE_DUTY[SQUARE2_CHANNEL.duty][SQUARE2_CHANNEL.duty_index])
@@ -135,5 +135,5 @@ int8_t sample_square2(const struct NES_Core* nes)
         return SQUARE2_CHANNEL.volume;
     }
 
-    return -SQUARE2_CHANNEL.volume;
+    return 0;
 }
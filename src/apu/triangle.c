@@ -51,19 +51,20 @@ void clock_triangle_linear(struct NES_Core* nes)
 
 void clock_triangle_duty(struct NES_Core* nes)
 {
+    // the triangle stops where it is rather than going silent,
+    // which would pop.
+    if (TRIANGLE_CHANNEL.length_counter == 0 || TRIANGLE_CHANNEL.linear_counter_load == 0)
+    {
+        return;
+    }
+
     ++TRIANGLE_CHANNEL.duty_index;
     TRIANGLE_CHANNEL.duty_index &= 0x1F;
 }
 
-int8_t sample_triangle(const struct NES_Core* nes)
+uint8_t sample_triangle(const struct NES_Core* nes)
 {
-    if (TRIANGLE_CHANNEL.length_counter == 0 || TRIANGLE_CHANNEL.linear_counter_load == 0)
-    {
-        return 0;
-    }
-
-    // i think this is right???
-    return TRIANGLE_DUTY_TABLE[TRIANGLE_CHANNEL.duty_index] * 2;
+    return TRIANGLE_DUTY_TABLE[TRIANGLE_CHANNEL.duty_index];
 }
 
 
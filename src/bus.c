@@ -16,6 +16,7 @@ static inline uint8_t nes_cpu_io_read(struct NES_Core* nes, uint16_t addr)
         case 0x0C: case 0x0D: case 0x0E: case 0x0F:
         case 0x10: case 0x11: case 0x12: case 0x13:
         case 0x15:
+            nes_apu_sync(nes);
             return nes_apu_io_read(nes, addr);
 
         case 0x14:
@@ -43,10 +44,13 @@ static inline void nes_cpu_io_write(struct NES_Core* nes, uint16_t addr, uint8_t
         case 0x0C: case 0x0D: case 0x0E: case 0x0F:
         case 0x10: case 0x11: case 0x12: case 0x13:
         case 0x15: case 0x17:
+            nes_apu_sync(nes);
             nes_apu_io_write(nes, addr, value);
             break;
 
         case 0x14:
+            nes_ppu_sync_access(nes, true);
+            nes_ppu_tile_write(nes);
             nes->ppu.oam_addr = value;
             nes_dma(nes);
             break;
@@ -78,18 +82,22 @@ static inline uint8_t nes_ppu_register_read(struct NES_Core* nes, uint16_t addr)
             break;
 
         case 0x7:
+        {
+            // the dot backend uses bit 14 for fine y
+            const uint16_t vram_addr = nes->ppu.vram_addr & 0x3FFF;
             // this returns the previous value as reads are delayed!
             data = nes->ppu.vram_latched_read;
             // save the new value
-            nes->ppu.vram_latched_read = nes_ppu_read(nes, nes->ppu.vram_addr);
+            nes->ppu.vram_latched_read = nes_ppu_read(nes, vram_addr);
             // palettes aren't delayed
-            if (nes->ppu.vram_addr > 0x3F00)
+            if (vram_addr > 0x3F00)
             {
                 data = nes->ppu.vram_latched_read;
             }
-            nes->ppu.vram_addr += nes->ppu.vram_addr_increment;
-            nes->ppu.vram_addr &= 0x3FFF;
+            // v is 15 bits
+            nes->ppu.vram_addr = (nes->ppu.vram_addr + nes->ppu.vram_addr_increment) & 0x7FFF;
             break;
+        }
 
             /* write only regs return current latched value. */
         default:
@@ -105,13 +113,22 @@ static inline void nes_ppu_register_write(struct NES_Core* nes, uint16_t addr, u
     switch (addr & 0x07)
     {
         case 0x0:
+            // changing the sprite size changes which lines sprites are on
+            if ((nes->ppu.ctrl ^ value) & 0x20)
+            {
+                nes->ppu.oam_dirty = true;
+            }
             nes->ppu.ctrl = value;
+            NES_RENDER_LOG(nes, RENDER_EVENT_CTRL, value, 0);
+            // t: ...GH.. ........ <- d: ......GH
+            nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xF3FF) | ((value & 0x03) << 10);
             // this inc is used for $2007 when writing, the addr is incremented
             nes->ppu.vram_addr_increment = ctrl_get_vram_addr(nes) ? 32 : 1;
             break;
 
         case 0x1:
             nes->ppu.mask = value;
+            NES_RENDER_LOG(nes, RENDER_EVENT_MASK, value, 0);
             break;
 
         case 0x3:
@@ -122,6 +139,8 @@ static inline void nes_ppu_register_write(struct NES_Core* nes, uint16_t addr, u
         case 0x4:
             // the addr is incremented after each write
             nes->ppu.oam[nes->ppu.oam_addr] = value;
+            nes->ppu.oam_dirty = true;
+            NES_RENDER_LOG(nes, RENDER_EVENT_OAM_WRITE, value, nes->ppu.oam_addr);
             nes->ppu.oam_addr = (nes->ppu.oam_addr + 1) & 0xFF;
             break;
 
@@ -130,11 +149,19 @@ static inline void nes_ppu_register_write(struct NES_Core* nes, uint16_t addr, u
             if (nes->ppu.has_first_8bit)
             {
                 nes->ppu.vertical_scroll_origin = value;
+                NES_RENDER_LOG(nes, RENDER_EVENT_SCROLL_Y, value, 0);
+                // t: FGH..AB CDE..... <- d: ABCDEFGH
+                nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0x8C1F) | ((value & 0xF8) << 2) | ((value & 0x07) << 12);
                 nes->ppu.has_first_8bit = false;
             }
             else
             {
                 nes->ppu.horizontal_scroll_origin = value;
+                NES_RENDER_LOG(nes, RENDER_EVENT_SCROLL_X, value, 0);
+                // t: ....... ...ABCDE <- d: ABCDE...
+                // x:              FGH <- d: .....FGH
+                nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xFFE0) | (value >> 3);
+                nes->ppu.fine_x = value & 0x07;
                 nes->ppu.has_first_8bit = true;
             }
             break;
@@ -143,7 +170,8 @@ static inline void nes_ppu_register_write(struct NES_Core* nes, uint16_t addr, u
         case 0x6:
             if (nes->ppu.has_first_8bit)
             {
-                // set the new vram addr
+                // set the new vram addr, this is the same as copying t to v
+                nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0xFF00) | value;
                 nes->ppu.vram_addr = (nes->ppu.write_flipflop << 8) | value;
                 nes->ppu.vram_addr &= 0x3FFF;
                 // reset the write_flipflop
@@ -154,16 +182,19 @@ static inline void nes_ppu_register_write(struct NES_Core* nes, uint16_t addr, u
             {
                 // store the MSB to the flipflop
                 nes->ppu.write_flipflop = value;
+                // t: .CDEFGH ........ <- d: ..CDEFGH, bit 14 is cleared
+                nes->ppu.tmp_addr = (nes->ppu.tmp_addr & 0x00FF) | ((value & 0x3F) << 8);
                 // also (or only?) seems to write to $2005 MSB
                 nes->ppu.horizontal_scroll_origin = value;
+                NES_RENDER_LOG(nes, RENDER_EVENT_SCROLL_X, value, 0);
                 nes->ppu.has_first_8bit = true;
             }
             break;
 
         case 0x7:
-            nes_ppu_write(nes, nes->ppu.vram_addr, value);
-            nes->ppu.vram_addr += nes->ppu.vram_addr_increment;
-            nes->ppu.vram_addr &= 0x3FFF;
+            nes_ppu_write(nes, nes->ppu.vram_addr & 0x3FFF, value);
+            // v is 15 bits, the dot backend uses bit 14 for fine y
+            nes->ppu.vram_addr = (nes->ppu.vram_addr + nes->ppu.vram_addr_increment) & 0x7FFF;
             break;
     }
 }
@@ -189,6 +220,7 @@ uint8_t nes_cpu_read(struct NES_Core* nes, uint16_t addr)
             return nes->wram[addr & 0x7FF];
 
         case 0x1:
+            nes_ppu_sync_access(nes, true);
             return nes_ppu_register_read(nes, addr);
 
         case 0x2:
@@ -221,6 +253,8 @@ void nes_cpu_write(struct NES_Core* nes, uint16_t addr, uint8_t value)
             break;
 
         case 0x1:
+            nes_ppu_sync_access(nes, true);
+            nes_ppu_tile_write(nes);
             nes_ppu_register_write(nes, addr & 0x7, value);
             break;
 
@@ -231,11 +265,18 @@ void nes_cpu_write(struct NES_Core* nes, uint16_t addr, uint8_t value)
             }
             break;
 
+        // prg ram, this can't change anything the ppu uses
         case 0x3:
+            nes_cart_write(nes, addr, value);
+            break;
+
+        // mapper registers may swap chr banks or change mirroring
         case 0x4:
         case 0x5:
         case 0x6:
         case 0x7:
+            nes_ppu_sync_access(nes, false);
+            nes_ppu_tile_write(nes);
             nes_cart_write(nes, addr, value);
             break;
     }
@@ -68,6 +68,11 @@ void mapper_set_pattern_table(struct NES_Core* nes, uint8_t table, const uint8_t
 {
     assert(table <= 1);
 
+    if (nes->ppu.read_map[table * 4] != rptr)
+    {
+        nes_ppu_chr_changed(nes);
+    }
+
     switch (table & 0x1)
     {
         case 0x0:
@@ -94,12 +99,19 @@ void mapper_set_pattern_table(struct NES_Core* nes, uint8_t table, const uint8_t
             nes->ppu.write_map[0x7] = wptr + 0xC00;
             break;
     }
+
+    NES_RENDER_LOG_MAP(nes, RENDER_EVENT_PATTERN_TABLE, table, rptr);
 }
 
 void mapper_set_nametable(struct NES_Core* nes, uint8_t table, const uint8_t* rptr, uint8_t* wptr)
 {
     assert(table <= 3);
 
+    if (nes->ppu.read_map[0x8 + table] != rptr)
+    {
+        nes_ppu_chr_changed(nes);
+    }
+
     switch (table & 0x3)
     {
         case 0x0:
@@ -130,6 +142,8 @@ void mapper_set_nametable(struct NES_Core* nes, uint8_t table, const uint8_t* rp
             nes->ppu.write_map[0xF] = wptr;
             break;
     }
+
+    NES_RENDER_LOG_MAP(nes, RENDER_EVENT_NAMETABLE, table, rptr);
 }
 
 void mapper_set_pattern_table_bank(struct NES_Core* nes, uint8_t table, uint32_t offset)
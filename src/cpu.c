@@ -379,11 +379,13 @@ void nes_cpu_nmi(struct NES_Core* nes)
 
 void nes_cpu_run(struct NES_Core* nes)
 {
-    nes->cpu.cycles = 0;
-
     const uint8_t opcode = read8(REG_PC++);
     uint16_t oprand;
 
+    // added up front so that while the instruction runs, this is the
+    // cycle of its last access, see nes_ppu_sync_access().
+    nes->cpu.cycles = CYCLE_PAIR_TABLE[opcode].c;
+
     switch (opcode)
     {
         case 0x01: INDX();  ORA();  break;
@@ -628,6 +630,4 @@ void nes_cpu_run(struct NES_Core* nes)
         case 0xFE: ABSX();  INC();  break;
         case 0xFF: ABSX();  ISC();  break;
     }
-
-    nes->cpu.cycles += CYCLE_PAIR_TABLE[opcode].c;
 }
@@ -57,6 +57,33 @@ extern "C" {
     #define UNREACHABLE(ret) return ret
 #endif // __has_builtin(__builtin_unreachable)
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define NES_SSE2 1
+#else
+    #define NES_SSE2 0
+#endif // __SSE2__
+
+// only what's needed for handing over frames to another thread
+#if defined(__GNUC__) || defined(__clang__)
+    #define NES_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+    #define NES_ATOMIC_CAS(ptr, expected, desired) __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#elif defined(_MSC_VER)
+    #include <intrin.h>
+    #define NES_ATOMIC_LOAD(ptr) ((uint32_t)_InterlockedOr((volatile long*)(ptr), 0))
+    #define NES_ATOMIC_CAS(ptr, expected, desired) nes_atomic_cas_msvc(ptr, expected, desired)
+    static inline bool nes_atomic_cas_msvc(uint32_t* ptr, uint32_t* expected, uint32_t desired)
+    {
+        const uint32_t old = (uint32_t)_InterlockedCompareExchange((volatile long*)ptr, (long)desired, (long)*expected);
+        const bool ok = old == *expected;
+        *expected = old;
+        return ok;
+    }
+#else
+    // no atomics, frames can only be taken on the same thread.
+    #define NES_ATOMIC_LOAD(ptr) (*(ptr))
+    #define NES_ATOMIC_CAS(ptr, expected, desired) (*(ptr) == *(expected) ? (*(ptr) = (desired), true) : (*(expected) = *(ptr), false))
+#endif
+
 // used mainly in debugging when i want to quickly silence
 // the compiler about unsed vars.
 #define UNUSED(var) ((void)(var))
@@ -92,6 +119,9 @@ enum
     APU_FRAME_SEQUENCER_CLOCK = MASTER_CLOCK / 89490,
 
     APU_FRAME_SEQUENCER_STEP_RATE = CPU_CLOCK / APU_FRAME_SEQUENCER_CLOCK,
+
+    // nes pixels either side that the ntsc filter blends into a pixel
+    NTSC_PIXEL_MARGIN = 2,
 };
 
 
@@ -116,14 +146,29 @@ struct NES_Core; // fwd
 
 
 NES_STATIC void nes_apu_init(struct NES_Core* nes);
+// writes the samples up to now into the audio buffer, called at vblank
+// and at the end of NES_run_frame()
+NES_STATIC void nes_apu_end_frame(struct NES_Core* nes);
 NES_STATIC void nes_ppu_init(struct NES_Core* nes);
 
 NES_STATIC bool nes_mapper_get_prg_chr_ram_size(uint8_t mapper, size_t* prg_size, size_t* chr_size);
 NES_STATIC bool nes_mapper_setup(struct NES_Core* nes, uint8_t mapper, enum Mirror mirror);
 
 NES_FORCE_INLINE void nes_cpu_run(struct NES_Core* nes);
-NES_FORCE_INLINE void nes_ppu_run(struct NES_Core* nes, const uint16_t cycles_elapsed);
-NES_FORCE_INLINE void nes_apu_run(struct NES_Core* nes, const uint16_t cycles_elapsed);
+// runs the apu up to the cpu, called before anything that can see or
+// change it, see apu/apu.c
+NES_STATIC void nes_apu_sync(struct NES_Core* nes);
+
+struct NES_Blip; // fwd
+
+// band-limited synthesis, see apu/blip.c
+NES_STATIC void nes_blip_clear(struct NES_Blip* blip);
+NES_STATIC void nes_blip_set_rate(struct NES_Blip* blip, uint32_t freq);
+// time is in cpu cycles from the start of the frame
+NES_STATIC void nes_blip_add_delta(struct NES_Blip* blip, uint32_t time, int32_t delta);
+NES_STATIC void nes_blip_end_frame(struct NES_Blip* blip, uint32_t time);
+// out can be NULL to drop the samples, returns the number read
+NES_STATIC uint32_t nes_blip_read(struct NES_Blip* blip, int16_t* out, uint32_t count);
 
 NES_INLINE uint8_t nes_cart_read(struct NES_Core* nes, uint16_t addr);
 NES_INLINE void nes_cart_write(struct NES_Core* nes, uint16_t addr, uint8_t value);
@@ -137,6 +182,46 @@ NES_STATIC void nes_dma(struct NES_Core* nes);
 NES_FORCE_INLINE uint8_t nes_ppu_read(struct NES_Core* nes, uint16_t addr);
 NES_FORCE_INLINE void nes_ppu_write(struct NES_Core* nes, uint16_t addr, uint8_t value);
 
+// called when anything the bg is rendered from changes outside of the
+// ppu, such as the mapper swapping chr banks.
+NES_STATIC void nes_ppu_chr_changed(struct NES_Core* nes);
+
+// hands over the finished frame if NES_set_pixel_buffers() is used,
+// called at vblank.
+NES_STATIC void nes_publish_frame(struct NES_Core* nes);
+
+#if NES_THREADS
+// renders the line to nes->pixels, used by the render workers
+NES_STATIC void nes_ppu_render_line(struct NES_Core* nes, uint8_t line);
+#endif // NES_THREADS
+// converts the line of pram indices to colours and writes it to nes->pixels
+NES_STATIC void nes_ppu_output_line(struct NES_Core* nes, uint8_t line, const uint8_t* pram);
+// called once the last line of the frame is done, hands over the frame
+NES_STATIC void nes_ppu_frame_done(struct NES_Core* nes);
+// writes the line through the ntsc filter, see ntsc.c
+NES_STATIC void nes_ntsc_line(struct NES_Core* nes, uint8_t line, uint16_t offset);
+// moves the ntsc carrier onto the next frame's phase
+NES_STATIC void nes_ntsc_end_frame(struct NES_Core* nes);
+// scales the lines of the finished frame, see scale.c
+NES_STATIC void nes_scale_lines(const struct NES_Core* nes, uint8_t line_start, uint8_t line_end);
+// returns the decoded row at the pattern address (2 bits per pixel,
+// pixel 0 in the top bits), flipped if needed. used by the debug views.
+NES_STATIC uint16_t nes_ppu_pattern_row(struct NES_Core* nes, uint16_t pattern_addr, bool xflip);
+// renders the lines the tile renderer has put off so far
+NES_STATIC void nes_ppu_tile_flush(struct NES_Core* nes);
+// same as above, then renders the rest of the frame line by line
+NES_STATIC void nes_ppu_tile_stop(struct NES_Core* nes);
+// called before any write that may change what's rendered
+NES_STATIC void nes_ppu_tile_write(struct NES_Core* nes);
+// runs the dot backend for the number of ppu dots
+NES_STATIC void nes_ppu_dot_run(struct NES_Core* nes, uint32_t dots);
+// catches the ppu up to the cpu, called before anything that can see or
+// change the ppu state, such as register access, dma and mapper writes.
+NES_STATIC void nes_ppu_sync(struct NES_Core* nes);
+// same as above, but for the cpu accessing the bus mid instruction.
+// register accesses on rendering lines switch on fine sync.
+NES_STATIC void nes_ppu_sync_access(struct NES_Core* nes, bool is_register);
+
 NES_STATIC void nes_cpu_nmi(struct NES_Core* nes);
 
 NES_INLINE uint8_t nes_joypad_read_port_0(struct NES_Core* nes);
@@ -151,6 +236,38 @@ NES_FORCE_INLINE void status_set_vblank(struct NES_Core* nes, uint8_t v);
 
 NES_STATIC uint8_t ctrl_get_vram_addr(const struct NES_Core* nes);
 NES_STATIC uint8_t ctrl_get_nmi(const struct NES_Core* nes);
+NES_STATIC uint8_t mask_get_greyscale(const struct NES_Core* nes);
+NES_STATIC uint8_t mask_get_bgr(const struct NES_Core* nes);
+
+#if NES_THREADS
+enum NES_RenderEventType
+{
+    RENDER_EVENT_LINE, // addr = line
+    RENDER_EVENT_CTRL, // value
+    RENDER_EVENT_MASK, // value
+    RENDER_EVENT_SCROLL_X, // value
+    RENDER_EVENT_SCROLL_Y, // value
+    RENDER_EVENT_PPU_WRITE, // addr, value
+    RENDER_EVENT_OAM_WRITE, // addr, value
+    RENDER_EVENT_PATTERN_TABLE, // value = table, addr = source, data = offset
+    RENDER_EVENT_NAMETABLE, // value = table, addr = source, data = offset
+    RENDER_EVENT_SCALE, // each worker scales its strip
+};
+
+NES_STATIC void nes_render_thread_log(struct NES_Core* nes, uint8_t type, uint8_t value, uint16_t addr, uint32_t data);
+NES_STATIC void nes_render_thread_log_map(struct NES_Core* nes, uint8_t type, uint8_t table, const uint8_t* ptr);
+NES_STATIC void nes_render_thread_log_line(struct NES_Core* nes, uint8_t line);
+// blocks until the workers have replayed everything logged so far
+NES_STATIC void nes_render_thread_wait(struct NES_Core* nes);
+// waits for the frame to be finished and collects the frame diff
+NES_STATIC void nes_render_thread_end_frame(struct NES_Core* nes);
+
+    #define NES_RENDER_LOG(nes, type, value, addr) do { if (UNLIKELY((nes)->render_thread != NULL)) { nes_render_thread_log(nes, type, value, addr, 0); } } while (0)
+    #define NES_RENDER_LOG_MAP(nes, type, table, ptr) do { if (UNLIKELY((nes)->render_thread != NULL)) { nes_render_thread_log_map(nes, type, table, ptr); } } while (0)
+#else
+    #define NES_RENDER_LOG(nes, type, value, addr) do { } while (0)
+    #define NES_RENDER_LOG_MAP(nes, type, table, ptr) do { } while (0)
+#endif // NES_THREADS
 
 #ifdef __cplusplus
 }
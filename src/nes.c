@@ -14,6 +14,9 @@ bool NES_init(struct NES_Core* nes)
 
     memset(nes, 0, sizeof(struct NES_Core));
 
+    nes->window.x_end = NES_SCREEN_WIDTH;
+    nes->window.line_end = NES_SCREEN_HEIGHT;
+
     return true;
 }
 
@@ -208,23 +211,511 @@ void NES_set_chr_ram(struct NES_Core* nes, uint8_t* data, size_t size)
     nes->chr_ram_size = size;
 }
 
+struct PixelTarget
+{
+    uint8_t format;
+    uint8_t bpp;
+    void* pixels;
+    uint8_t* u;
+    uint8_t* v;
+    uint32_t stride;
+    uint32_t uv_stride;
+    const struct NES_Ntsc* ntsc;
+};
+
+static void set_pixels(struct NES_Core* nes, const struct PixelTarget* target)
+{
+    // lines done so far go to the old buffer
+    nes_ppu_tile_flush(nes);
+
+    nes->pixel_format = target->format;
+    nes->bpp = target->bpp;
+    nes->pixels = target->pixels;
+    nes->pixels_u = target->u;
+    nes->pixels_v = target->v;
+    nes->pixels_stride = target->stride;
+    nes->pixels_uv_stride = target->uv_stride;
+    nes->ntsc = target->ntsc;
+
+    // the new buffer has no previous frame, so mark it all as changed
+    memset(nes->frame_colour, 0xFF, sizeof(nes->frame_colour));
+}
+
+static void set_pixels_all(struct NES_Core* nes, const struct PixelTarget* target)
+{
+    nes->pixel_buffers.count = 0;
+
+    set_pixels(nes, target);
+
+#if NES_THREADS
+    // the workers have to be idle before their copy can be changed
+    if (nes->render_thread)
+    {
+        nes_render_thread_wait(nes);
+
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            set_pixels(&nes->render_thread->workers[i].core, target);
+        }
+    }
+#endif
+}
+
 void NES_set_pixels(struct NES_Core* nes, void* pixels, uint32_t stride, uint8_t bpp)
+{
+    const struct PixelTarget target =
+    {
+        .format = NES_PIXEL_FORMAT_PALETTE,
+        .bpp = bpp,
+        .pixels = pixels,
+        .stride = stride,
+    };
+
+    set_pixels_all(nes, &target);
+}
+
+void NES_set_pixels_rgb565(struct NES_Core* nes, uint16_t* pixels, uint32_t stride)
+{
+    const struct PixelTarget target =
+    {
+        .format = NES_PIXEL_FORMAT_RGB565,
+        .bpp = 16,
+        .pixels = pixels,
+        .stride = stride,
+    };
+
+    set_pixels_all(nes, &target);
+}
+
+void NES_set_pixels_yuv420(struct NES_Core* nes, uint8_t* y, uint8_t* u, uint8_t* v, uint32_t y_stride, uint32_t uv_stride)
+{
+    const struct PixelTarget target =
+    {
+        .format = NES_PIXEL_FORMAT_YUV420,
+        .bpp = 8,
+        .pixels = y,
+        .u = u,
+        .v = v,
+        .stride = y_stride,
+        .uv_stride = uv_stride,
+    };
+
+    set_pixels_all(nes, &target);
+}
+
+void NES_set_pixels_ntsc(struct NES_Core* nes, const struct NES_Ntsc* ntsc, uint32_t* pixels, uint32_t stride)
+{
+    const struct PixelTarget target =
+    {
+        .format = NES_PIXEL_FORMAT_NTSC,
+        .bpp = 32,
+        .pixels = pixels,
+        .stride = stride,
+        .ntsc = ntsc,
+    };
+
+    set_pixels_all(nes, &target);
+}
+
+// the state shared with the thread taking the frames
+enum
+{
+    PIXEL_STATE_READY_MASK = 0x03, // index of the newest finished buffer
+    PIXEL_STATE_HELD_SHIFT = 2, // index of the buffer the caller has
+    PIXEL_STATE_NEW = 1 << 4, // ready buffer hasn't been taken yet
+    PIXEL_STATE_HELD = 1 << 5, // caller has a buffer
+};
+
+static FORCE_INLINE uint8_t pixel_state_get_held(uint32_t state)
+{
+    return (state >> PIXEL_STATE_HELD_SHIFT) & 0x3;
+}
+
+bool NES_set_pixel_buffers(struct NES_Core* nes, void* const* buffers, uint8_t count, uint32_t stride, uint8_t bpp)
+{
+    if (count != 2 && count != 3)
+    {
+        return false;
+    }
+
+    struct NES_PixelBuffers* pb = &nes->pixel_buffers;
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        pb->buffers[i] = buffers[i];
+        pb->frame[i] = 0;
+    }
+
+    pb->state = 0;
+    pb->write = 0;
+
+    NES_set_pixels(nes, buffers[0], stride, bpp);
+
+    pb->count = count;
+
+    return true;
+}
+
+// changes the buffer being rendered to, keeping the frame diff.
+static void set_pixels_target(struct NES_Core* nes, void* pixels)
 {
     nes->pixels = pixels;
-    nes->pixels_stride = stride;
-    nes->bpp = bpp;
+
+#if NES_THREADS
+    // the workers are idle during vblank
+    if (nes->render_thread)
+    {
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            nes->render_thread->workers[i].core.pixels = pixels;
+        }
+    }
+#endif
+}
+
+void nes_publish_frame(struct NES_Core* nes)
+{
+    struct NES_PixelBuffers* pb = &nes->pixel_buffers;
+
+    pb->frame_counter++;
+
+    if (!pb->count)
+    {
+        return;
+    }
+
+    pb->frame[pb->write] = pb->frame_counter;
+
+    uint32_t state = NES_ATOMIC_LOAD(&pb->state);
+    uint32_t new_state;
+    uint8_t next;
+
+    do
+    {
+        const bool held = state & PIXEL_STATE_HELD;
+
+        // with 2 buffers, the other one might still be used by the caller.
+        // in that case the frame is dropped and the same buffer is reused.
+        if (pb->count == 2 && held)
+        {
+            return;
+        }
+
+        // next is any buffer that isn't going to be ready or held
+        for (next = 0; next < pb->count; ++next)
+        {
+            if (next != pb->write && !(held && next == pixel_state_get_held(state)))
+            {
+                break;
+            }
+        }
+
+        new_state = (state & ~(PIXEL_STATE_READY_MASK)) | pb->write | PIXEL_STATE_NEW;
+    } while (!NES_ATOMIC_CAS(&pb->state, &state, new_state));
+
+    pb->write = next;
+    set_pixels_target(nes, pb->buffers[next]);
+}
+
+const void* NES_acquire_frame(struct NES_Core* nes, uint32_t* frame_number)
+{
+    struct NES_PixelBuffers* pb = &nes->pixel_buffers;
+    uint32_t state = NES_ATOMIC_LOAD(&pb->state);
+    uint32_t new_state;
+    uint8_t ready;
+
+    do
+    {
+        if (!(state & PIXEL_STATE_NEW))
+        {
+            return NULL;
+        }
+
+        // taking the ready buffer gives back the one that was held
+        ready = state & PIXEL_STATE_READY_MASK;
+        new_state = ready | (ready << PIXEL_STATE_HELD_SHIFT) | PIXEL_STATE_HELD;
+    } while (!NES_ATOMIC_CAS(&pb->state, &state, new_state));
+
+    if (frame_number)
+    {
+        *frame_number = pb->frame[ready];
+    }
+
+    return pb->buffers[ready];
+}
+
+void NES_release_frame(struct NES_Core* nes)
+{
+    struct NES_PixelBuffers* pb = &nes->pixel_buffers;
+    uint32_t state = NES_ATOMIC_LOAD(&pb->state);
+
+    while (!NES_ATOMIC_CAS(&pb->state, &state, state & ~PIXEL_STATE_HELD))
+    {
+    }
+}
+
+enum
+{
+    // channels that aren't emphasised are darkened to ~82%, out of 256
+    EMPHASIS_ATTENUATION = 209,
+};
+
+static uint32_t palette_attenuate(uint32_t colour, uint32_t mask)
+{
+    // scaling the masked channel in place works for any bit position,
+    // the bits that end up below the channel are masked off.
+    const uint64_t channel = colour & mask;
+
+    return (colour & ~mask) | ((uint32_t)((channel * EMPHASIS_ATTENUATION) >> 8) & mask);
+}
+
+static void build_palette(uint32_t* out, const struct NES_Palette* palette)
+{
+    // emphasis bit 0 is red, 1 is green, 2 is blue.
+    const uint32_t masks[3] = { palette->rmask, palette->gmask, palette->bmask };
+
+    for (uint8_t emphasis = 0; emphasis < 8; ++emphasis)
+    {
+        for (uint8_t i = 0; i < 64; ++i)
+        {
+            uint32_t colour = palette->colour[i];
+
+            // columns $xE and $xF are black and aren't affected
+            if ((i & 0x0E) != 0x0E)
+            {
+                for (uint8_t channel = 0; channel < 3; ++channel)
+                {
+                    // a channel is darkened by each of the other channels
+                    // being emphasised, so with all 3 set everything is.
+                    const uint8_t others = emphasis & ~(1 << channel);
+
+                    for (uint8_t bit = 0; bit < 3; ++bit)
+                    {
+                        if (IS_BIT_SET(others, bit))
+                        {
+                            colour = palette_attenuate(colour, masks[channel]);
+                        }
+                    }
+                }
+            }
+
+            out[(emphasis * 64) + i] = colour;
+        }
+    }
+}
+
+// returns the channel scaled to 0-255
+static uint8_t palette_get_channel(uint32_t colour, uint32_t mask)
+{
+    if (!mask)
+    {
+        return 0;
+    }
+
+    uint8_t shift = 0;
+
+    while (!IS_BIT_SET(mask, shift))
+    {
+        ++shift;
+    }
+
+    const uint32_t max = mask >> shift;
+
+    return (((colour & mask) >> shift) * 255) / max;
+}
+
+// converts the (already emphasised) host colours into the built in formats
+static void build_palette_formats(struct NES_Core* nes, const struct NES_Palette* palette)
+{
+    for (uint16_t i = 0; i < ARRAY_SIZE(nes->palette); ++i)
+    {
+        const int32_t r = palette_get_channel(nes->palette[i], palette->rmask);
+        const int32_t g = palette_get_channel(nes->palette[i], palette->gmask);
+        const int32_t b = palette_get_channel(nes->palette[i], palette->bmask);
+
+        nes->palette_rgb565[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+
+        // bt.601 limited range
+        nes->palette_yuv[0][i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+        nes->palette_yuv[1][i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+        nes->palette_yuv[2][i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+    }
+}
+
+bool NES_set_render_window(struct NES_Core* nes, uint16_t x, uint8_t y, uint16_t w, uint8_t h)
+{
+    if (!w || !h || x + w > NES_SCREEN_WIDTH || y + h > NES_SCREEN_HEIGHT)
+    {
+        return false;
+    }
+
+    // rounded out to even so that yuv420 chroma blocks are whole
+    const struct NES_RenderWindow window =
+    {
+        .x_start = x & ~1,
+        .x_end = (x + w + 1) & ~1,
+        .line_start = y & ~1,
+        .line_end = (y + h + 1) & ~1,
+    };
+
+    // lines done so far use the old window
+    nes_ppu_tile_flush(nes);
+
+    nes->window = window;
+    // newly shown areas have no previous frame, so mark it all as changed
+    memset(nes->frame_colour, 0xFF, sizeof(nes->frame_colour));
+
+#if NES_THREADS
+    // the workers have to be idle before their copy can be changed
+    if (nes->render_thread)
+    {
+        nes_render_thread_wait(nes);
+
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            nes->render_thread->workers[i].core.window = window;
+            memset(nes->render_thread->workers[i].core.frame_colour, 0xFF, sizeof(nes->frame_colour));
+        }
+    }
+#endif
+
+    return true;
+}
+
+void NES_set_layers(struct NES_Core* nes, struct NES_Layers* layers)
+{
+    nes_ppu_tile_flush(nes);
+
+    nes->layers = layers;
+    nes->layer_objs_seen = 0;
+
+#if NES_THREADS
+    // the workers have to be idle before their copy can be changed
+    if (nes->render_thread)
+    {
+        nes_render_thread_wait(nes);
+
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            nes->render_thread->workers[i].core.layers = layers;
+            nes->render_thread->workers[i].core.layer_objs_seen = 0;
+        }
+    }
+#endif
 }
 
 void NES_set_palette(struct NES_Core* nes, const struct NES_Palette* palette)
 {
-    memcpy(&nes->palette, palette, sizeof(nes->palette));
+    nes_ppu_tile_flush(nes);
+
+    build_palette(nes->palette, palette);
+    build_palette_formats(nes, palette);
+
+    nes->palette_mask[0] = palette->rmask;
+    nes->palette_mask[1] = palette->gmask;
+    nes->palette_mask[2] = palette->bmask;
+
+    // every pixel's colour changes without its pram index changing, so
+    // mark it all as changed
+    memset(nes->frame_colour, 0xFF, sizeof(nes->frame_colour));
+
+#if NES_THREADS
+    if (nes->render_thread)
+    {
+        nes_render_thread_wait(nes);
+
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            memcpy(nes->render_thread->workers[i].core.palette, nes->palette, sizeof(nes->palette));
+            memcpy(nes->render_thread->workers[i].core.palette_rgb565, nes->palette_rgb565, sizeof(nes->palette_rgb565));
+            memcpy(nes->render_thread->workers[i].core.palette_yuv, nes->palette_yuv, sizeof(nes->palette_yuv));
+            memcpy(nes->render_thread->workers[i].core.palette_mask, nes->palette_mask, sizeof(nes->palette_mask));
+            memset(nes->render_thread->workers[i].core.frame_colour, 0xFF, sizeof(nes->frame_colour));
+        }
+    }
+#endif
 }
 
-void NES_set_apu_callback(struct NES_Core* nes, nes_apu_callback_t cb, void* user, uint32_t freq)
+void NES_set_ppu_backend(struct NES_Core* nes, enum NES_PpuBackend backend)
 {
-    nes->apu_callback = cb;
-    nes->apu_callback_user = user;
-    nes->apu_callback_freq = freq;
+    if (nes->ppu_backend == backend)
+    {
+        return;
+    }
+
+    // run up to now with the old backend
+    nes_ppu_sync(nes);
+    nes_ppu_tile_stop(nes);
+
+    nes->ppu_backend = backend;
+
+    // these are only used by the fast backend, so may be stale
+    nes->ppu.obj_hit_cycle = -1;
+    nes->ppu.oam_dirty = true;
+
+    // vblank is at a different point for each backend, so sync on the
+    // next step to find out when it is.
+    nes->ppu.next_event = 0;
+}
+
+// left and right are only mixed separately if anything is panned
+static void audio_update_panned(struct NES_Core* nes)
+{
+    bool panned = false;
+
+    for (uint8_t i = 0; i < NES_AUDIO_CHANNEL_COUNT; ++i)
+    {
+        const int8_t pan = nes->audio_pan[i];
+
+        nes->audio_gain[0][i] = pan <= 0 ? 256 : 256 - (pan * 2);
+        nes->audio_gain[1][i] = pan >= 0 ? 256 : 256 + (pan * 2);
+        panned |= pan != 0;
+    }
+
+    panned &= nes->audio_channels == 2;
+
+    // the right side carries on from where the left was
+    if (panned && !nes->audio_panned)
+    {
+        memcpy(&nes->blip[1], &nes->blip[0], sizeof(nes->blip[1]));
+        nes->audio_amp[1] = nes->audio_amp[0];
+    }
+
+    nes->audio_panned = panned;
+}
+
+void NES_set_audio_buffer(struct NES_Core* nes, void* samples, uint32_t size, enum NES_AudioFormat format, uint8_t channels, uint32_t freq)
+{
+    nes->audio_buffer = samples;
+    nes->audio_buffer_size = size;
+    nes->audio_format = format;
+    nes->audio_channels = channels == 2 ? 2 : 1;
+    nes->audio_freq = freq;
+    nes->audio_count = 0;
+    nes->audio_time = 0;
+    nes->audio_amp[0] = 0;
+    nes->audio_amp[1] = 0;
+    nes->audio_panned = false;
+
+    nes_blip_set_rate(&nes->blip[0], freq);
+    nes_blip_set_rate(&nes->blip[1], freq);
+    audio_update_panned(nes);
+}
+
+void NES_set_audio_pan(struct NES_Core* nes, enum NES_AudioChannel channel, int8_t pan)
+{
+    if (channel >= NES_AUDIO_CHANNEL_COUNT)
+    {
+        return;
+    }
+
+    nes->audio_pan[channel] = pan;
+    audio_update_panned(nes);
+}
+
+uint32_t NES_get_audio_sample_count(const struct NES_Core* nes)
+{
+    return nes->audio_count;
 }
 
 void NES_set_vblank_callback(struct NES_Core* nes, nes_vblank_callback_t cb, void* user)
@@ -233,22 +724,54 @@ void NES_set_vblank_callback(struct NES_Core* nes, nes_vblank_callback_t cb, voi
     nes->vblank_callback_user = user;
 }
 
+const struct NES_FrameDiff* NES_get_frame_diff(const struct NES_Core* nes)
+{
+    return &nes->frame_diff;
+}
+
 void NES_step(struct NES_Core* nes)
 {
     nes->cpu.cycles = 0;
 
     nes_cpu_run(nes);
-    nes_ppu_run(nes, nes->cpu.cycles);
-    nes_apu_run(nes, nes->cpu.cycles);
+
+    // the ppu is only run when something could see it, which is either
+    // the cpu touching it (see bus.c), or the nmi at vblank.
+    // part of the instruction may have already been run by a fine sync.
+    nes->ppu.lag += nes->cpu.cycles - nes->ppu.step_synced;
+    nes->ppu.step_synced = 0;
+
+    if (UNLIKELY(nes->ppu.lag >= nes->ppu.next_event))
+    {
+        nes_ppu_sync(nes);
+    }
+
+    // same for the apu, which is also caught up at the end of the frame
+    // or once it's a frame behind.
+    nes->apu.lag += nes->cpu.cycles;
+
+    if (UNLIKELY(nes->apu.lag >= CPU_CYCLES_PER_FRAME))
+    {
+        nes_apu_sync(nes);
+    }
 }
 
-void NES_run_frame(struct NES_Core* nes)
+uint32_t NES_run_frame(struct NES_Core* nes)
 {
     uint32_t cycles = 0;
 
+    nes->audio_count = 0;
+
     while (cycles < CPU_CYCLES_PER_FRAME)
     {
         NES_step(nes);
         cycles += nes->cpu.cycles;
     }
+
+    // so that the lines rendered so far are up to date
+    nes_ppu_sync(nes);
+    nes_ppu_tile_flush(nes);
+    nes_apu_end_frame(nes);
+
+    return nes->audio_count;
 }
@@ -29,19 +29,118 @@ NESAPI bool NES_get_rom_info(const uint8_t* rom, size_t size, struct NES_RomInfo
 NESAPI void NES_set_prg_ram(struct NES_Core* nes, uint8_t* data, size_t size);
 NESAPI void NES_set_chr_ram(struct NES_Core* nes, uint8_t* data, size_t size);
 
+// pixels can be NULL to run headless, nothing is rendered but sprite 0 hit
+// and sprite overflow are still set at the same time as when rendering.
 NESAPI void NES_set_pixels(struct NES_Core* nes, void* pixels, uint32_t stride, uint8_t bpp);
+// these write a fixed format, converted from the palette given to
+// NES_set_palette() using its channel masks, so the masks must be set.
+// yuv420 is planar bt.601 (limited range) for feeding video encoders
+// directly. y is 256x240, u and v are 128x120, each chroma sample being
+// the average of a 2x2 block.
+NESAPI void NES_set_pixels_rgb565(struct NES_Core* nes, uint16_t* pixels, uint32_t stride);
+NESAPI void NES_set_pixels_yuv420(struct NES_Core* nes, uint8_t* y, uint8_t* u, uint8_t* v, uint32_t y_stride, uint32_t uv_stride);
+// builds the kernels for the ntsc filter. this takes a while, so only
+// call it when the setup changes.
+NESAPI void NES_ntsc_init(struct NES_Ntsc* ntsc, const struct NES_NtscSetup* setup);
+// renders through the ntsc filter, simulating the composite signal from
+// each line's colours and emphasis. pixels is NES_NTSC_WIDTH x 240 of
+// 0xFFRRGGBB. ntsc has to stay valid while it's in use.
+NESAPI void NES_set_pixels_ntsc(struct NES_Core* nes, const struct NES_Ntsc* ntsc, uint32_t* pixels, uint32_t stride);
+// registers 2 or 3 buffers that are rendered into in turn. at vblank, the
+// finished buffer is handed over and the core moves onto the next one.
+// another thread can then take the newest frame with NES_acquire_frame()
+// without copying it, and without it being written to while it's held.
+// with 3 buffers the core never waits for the caller. with 2, if the
+// caller is still holding the other buffer, that frame is dropped.
+// returns false if count isn't 2 or 3, use NES_set_pixels() to go back
+// to a single buffer.
+NESAPI bool NES_set_pixel_buffers(struct NES_Core* nes, void* const* buffers, uint8_t count, uint32_t stride, uint8_t bpp);
+// returns the newest finished frame, or NULL if there isn't a new frame
+// since the last call. this can be called from any thread.
+// the buffer is held until NES_release_frame() or the next acquire.
+NESAPI const void* NES_acquire_frame(struct NES_Core* nes, uint32_t* frame_number);
+NESAPI void NES_release_frame(struct NES_Core* nes);
 NESAPI void NES_set_palette(struct NES_Core* nes, const struct NES_Palette* palette);
 
+// only renders the pixels inside the window, everything else in the
+// buffer is left as is. sprite 0 hit, sprite overflow and everything
+// else the cpu can see still covers the whole frame. the window is
+// rounded out to even sizes. returns false if it's empty or off screen,
+// use 0, 0, NES_SCREEN_WIDTH, NES_SCREEN_HEIGHT to render everything.
+NESAPI bool NES_set_render_window(struct NES_Core* nes, uint16_t x, uint8_t y, uint16_t w, uint8_t h);
+// also outputs the bg and sprite layers separately, along with a list of
+// the sprites drawn each frame. the layers are written as each line is
+// rendered (in the render window), the list is filled in at vblank.
+// this is only done by the fast backend, pass NULL to turn it off.
+NESAPI void NES_set_layers(struct NES_Core* nes, struct NES_Layers* layers);
+// scales every finished frame into out at vblank, before the vblank
+// callback. the input is the buffer given to NES_set_pixels() (or the
+// frame about to be handed over by NES_set_pixel_buffers()).
+// out is (256 * scale) x (240 * scale) in the same format, stride is in
+// pixels. nearest supports a scale of 2-6, scale2x 2, scale3x 3, hq2x 2.
+// hq2x blends colours, so it needs the palette masks (or rgb565).
+// yuv420 and ntsc can't be scaled. with render threads, each worker scales its
+// own strip. returns false if the scaler / scale isn't valid, pass NULL
+// to turn it off.
+NESAPI bool NES_set_scaler(struct NES_Core* nes, enum NES_Scaler scaler, uint8_t scale, void* out, uint32_t out_stride);
+
+// the fast backend is used by default. this can be changed at any time,
+// though the frame it's changed on may have a glitch.
+NESAPI void NES_set_ppu_backend(struct NES_Core* nes, enum NES_PpuBackend backend);
+
 NESAPI bool NES_loadrom(struct NES_Core* nes, const uint8_t* rom, size_t size);
 
 NESAPI void NES_run_step(struct NES_Core* nes);
-NESAPI void NES_run_frame(struct NES_Core* nes);
+// returns the number of audio samples written during the frame.
+NESAPI uint32_t NES_run_frame(struct NES_Core* nes);
 
 NESAPI void NES_set_button(struct NES_Core* nes, enum NES_Button button, bool down);
 
-NESAPI void NES_set_apu_callback(struct NES_Core* nes, nes_apu_callback_t cb, void* user, uint32_t freq);
+// the apu writes samples of the format at freq into samples as it runs,
+// interleaved left / right if channels is 2. size is the number of
+// samples (per channel) that fit, any more in a frame are dropped.
+// the buffer is rewound at the start of each NES_run_frame(), which
+// returns how many were written, so ~freq/60 + a few is enough.
+// the channels go through the nes' nonlinear mixer. pass NULL to turn
+// audio off.
+NESAPI void NES_set_audio_buffer(struct NES_Core* nes, void* samples, uint32_t size, enum NES_AudioFormat format, uint8_t channels, uint32_t freq);
+// pans the channel from -128 (left) to 127 (right), 0 being the centre
+// (the default). only used with 2 channels.
+NESAPI void NES_set_audio_pan(struct NES_Core* nes, enum NES_AudioChannel channel, int8_t pan);
+// the number of samples written so far this frame, such as from the
+// vblank callback. samples are written at vblank and at the end of
+// NES_run_frame().
+NESAPI uint32_t NES_get_audio_sample_count(const struct NES_Core* nes);
 NESAPI void NES_set_vblank_callback(struct NES_Core* nes, nes_vblank_callback_t cb, void* user);
 
+// debug views of the current ppu state, only rendered when called.
+// these write the 32-bit colours given to NES_set_palette(), with the
+// current emphasis and greyscale, stride is in pixels. call these from
+// the thread running the core, such as in the vblank callback.
+// the sizes are NES_DEBUG_*_WIDTH x NES_DEBUG_*_HEIGHT.
+// both pattern tables side by side, using palette (0-3 bg, 4-7 obj).
+NESAPI void NES_debug_pattern_tables(struct NES_Core* nes, uint32_t* pixels, uint32_t stride, uint8_t palette);
+// all 4 nametables through the current mirroring, in a 2x2 grid.
+NESAPI void NES_debug_nametables(struct NES_Core* nes, uint32_t* pixels, uint32_t stride);
+// the 64 sprites in oam order, 8 per row in 8x16 cells.
+NESAPI void NES_debug_oam(struct NES_Core* nes, uint32_t* pixels, uint32_t stride);
+// the 32 palette entries as 8x8 squares, bg on top and obj below.
+NESAPI void NES_debug_palette(struct NES_Core* nes, uint32_t* pixels, uint32_t stride);
+
+// returns the rows / tiles that changed since the last frame.
+// only valid when called from within the vblank callback.
+NESAPI const struct NES_FrameDiff* NES_get_frame_diff(const struct NES_Core* nes);
+
+#if NES_THREADS
+// renders on other threads, which replay a log of the ppu writes made
+// by the cpu. the frame is finished by the time the vblank callback
+// is called, so nothing changes for the caller.
+// with more than 1 worker, each renders its own strip of the frame.
+// call this after NES_loadrom(), ctx and workers must stay valid until stopped.
+NESAPI bool NES_start_render_thread(struct NES_Core* nes, struct NES_RenderThread* ctx, struct NES_RenderWorker* workers, uint8_t count);
+NESAPI void NES_stop_render_thread(struct NES_Core* nes);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,254 @@
+#include "nes.h"
+#include "internal.h"
+
+#include <string.h>
+
+#if NES_SSE2
+    #include <emmintrin.h>
+#endif
+
+
+// SOURCE: https://www.nesdev.org/wiki/NTSC_video
+//
+// the ppu outputs a square wave for each pixel, 8 samples long, with 12
+// samples per colour cycle. so the carrier starts at 1 of 3 phases for
+// each pixel, and moves by 1 phase each line and each frame.
+//
+// decoding (luma low pass, chroma demodulation, yiq to rgb) is linear,
+// so rather than doing it per pixel, the rgb that each colour adds to the
+// 8 output pixels around it is worked out up front for every colour,
+// emphasis and phase. a line is then just adding up these kernels.
+//
+// everything is fixed point, Q12 unless said otherwise.
+
+enum
+{
+    NTSC_PHASES = 12,
+    NTSC_SAMPLES_PER_PIXEL = 8,
+    NTSC_SAMPLES_PER_OUT = NTSC_SAMPLES_PER_PIXEL / (NES_NTSC_WIDTH / NES_SCREEN_WIDTH),
+
+    // signal levels in mV
+    NTSC_BLACK = 518,
+    NTSC_WHITE = 1962,
+    // emphasis attenuates the signal to 74.6%
+    NTSC_EMPHASIS = 746,
+
+    // chroma is filtered over 2 colour cycles with a triangle window,
+    // the weights (24 - |2o + 1|) add up to this.
+    NTSC_CHROMA_HALF = 12,
+    NTSC_CHROMA_SUM = 288,
+
+    // output pixel 2x + d is in kernel[d + NTSC_KERNEL_OFFSET]
+    NTSC_KERNEL_OFFSET = 3,
+};
+
+static const int16_t NTSC_LOW[4] = { 350, 518, 962, 1550 };
+static const int16_t NTSC_HIGH[4] = { 1094, 1506, 1962, 1962 };
+
+// cos / sin of each phase, including the hue offset of the colour burst
+static const int16_t NTSC_COS[NTSC_PHASES] = { -1860, -3435, -4090, -3650, -2231, -214, 1860, 3435, 4090, 3650, 2231, 214 };
+static const int16_t NTSC_SIN[NTSC_PHASES] = { 3650, 2231, 214, -1860, -3435, -4090, -3650, -2231, -214, 1860, 3435, 4090 };
+
+static FORCE_INLINE bool ntsc_in_phase(uint8_t hue, uint8_t phase)
+{
+    return ((hue + phase) % NTSC_PHASES) < 6;
+}
+
+// returns the signal of the colour (emphasis * 64 + colour) at the phase,
+// black is 0 and white is 4096.
+static int32_t ntsc_signal(uint16_t colour, uint8_t phase)
+{
+    const uint8_t hue = colour & 0x0F;
+    const uint8_t lum = (colour >> 4) & 0x3;
+    const uint8_t emphasis = (colour >> 6) & 0x7;
+
+    // $xE and $xF are black
+    if (hue >= 0x0E)
+    {
+        return 0;
+    }
+
+    int32_t level;
+
+    switch (hue)
+    {
+        case 0x00: level = NTSC_HIGH[lum]; break;
+        case 0x0D: level = NTSC_LOW[lum]; break;
+        default: level = ntsc_in_phase(hue, phase) ? NTSC_HIGH[lum] : NTSC_LOW[lum]; break;
+    }
+
+    // each emphasis bit darkens the half of the cycle of its colour
+    if ((IS_BIT_SET(emphasis, 0) && ntsc_in_phase(0x0C, phase)) ||
+        (IS_BIT_SET(emphasis, 1) && ntsc_in_phase(0x04, phase)) ||
+        (IS_BIT_SET(emphasis, 2) && ntsc_in_phase(0x08, phase)))
+    {
+        level = (level * NTSC_EMPHASIS) / 1000;
+    }
+
+    return ((level - NTSC_BLACK) * 4096) / (NTSC_WHITE - NTSC_BLACK);
+}
+
+// works out what the pixel adds to output pixel 2x + d, for a pixel
+// that starts at the phase.
+static void ntsc_build_kernel(int32_t* out, uint16_t colour, uint8_t phase, int32_t d, int32_t luma_width, int32_t saturation)
+{
+    int64_t y = 0;
+    int64_t i = 0;
+    int64_t q = 0;
+
+    for (int32_t k = 0; k < NTSC_SAMPLES_PER_PIXEL; ++k)
+    {
+        const uint8_t sample_phase = (phase + k) % NTSC_PHASES;
+        const int32_t v = ntsc_signal(colour, sample_phase);
+
+        // distance of the sample from the middle of the output pixel
+        const int32_t o = k - (NTSC_SAMPLES_PER_OUT * d) - (NTSC_SAMPLES_PER_OUT / 2);
+
+        // luma is a box filter, 12 samples wide removes the carrier
+        if (o >= -(luma_width / 2) && o < luma_width - (luma_width / 2))
+        {
+            y += v;
+        }
+
+        if (o >= -NTSC_CHROMA_HALF && o < NTSC_CHROMA_HALF)
+        {
+            const int32_t weight = (NTSC_CHROMA_HALF * 2) - ((2 * o + 1) < 0 ? -(2 * o + 1) : (2 * o + 1));
+
+            i += (int64_t)v * NTSC_COS[sample_phase] * weight;
+            q += (int64_t)v * NTSC_SIN[sample_phase] * weight;
+        }
+    }
+
+    y /= luma_width;
+    i = (i * saturation) / ((int64_t)NTSC_CHROMA_SUM * 4096 * 100);
+    q = (q * saturation) / ((int64_t)NTSC_CHROMA_SUM * 4096 * 100);
+
+    // fcc yiq to rgb
+    const int64_t r = y + ((3878 * i + 2554 * q) / 4096);
+    const int64_t g = y + ((-1126 * i - 2604 * q) / 4096);
+    const int64_t b = y + ((-4541 * i + 7000 * q) / 4096);
+
+    // stored as 0-255 in Q8, in the byte order of 0xAARRGGBB
+    out[0] = (int32_t)((b * 255 * 256) / 4096);
+    out[1] = (int32_t)((g * 255 * 256) / 4096);
+    out[2] = (int32_t)((r * 255 * 256) / 4096);
+    out[3] = 0;
+}
+
+void NES_ntsc_init(struct NES_Ntsc* ntsc, const struct NES_NtscSetup* setup)
+{
+    const int32_t sharpness = setup->sharpness < -100 ? -100 : setup->sharpness > 100 ? 100 : setup->sharpness;
+    const int32_t luma_width = 12 - ((sharpness * 6) / 100);
+
+    for (uint8_t phase = 0; phase < 3; ++phase)
+    {
+        for (uint16_t colour = 0; colour < 8 * 64; ++colour)
+        {
+            for (int32_t d = 0; d < NES_NTSC_KERNEL_SIZE; ++d)
+            {
+                ntsc_build_kernel(ntsc->kernel[phase][colour][d], colour, phase * 4, d - NTSC_KERNEL_OFFSET, luma_width, setup->saturation);
+            }
+        }
+    }
+
+    ntsc->no_crawl = setup->no_crawl;
+}
+
+void nes_ntsc_line(struct NES_Core* nes, uint8_t line, uint16_t offset)
+{
+    const struct NES_Ntsc* ntsc = nes->ntsc;
+    const uint8_t* colour = nes->frame_colour[line];
+    uint32_t* out = (uint32_t*)nes->pixels + nes->pixels_stride * line;
+
+    // the kernels spill over each side of the line
+    int32_t acc[NES_NTSC_WIDTH + NES_NTSC_KERNEL_SIZE][4];
+    memset(acc, 0, sizeof(acc));
+
+    // only the window is written, which needs the pixels either side
+    const uint16_t out_start = nes->window.x_start * 2;
+    const uint16_t out_end = nes->window.x_end * 2;
+    const uint16_t x_start = nes->window.x_start > NTSC_PIXEL_MARGIN ? nes->window.x_start - NTSC_PIXEL_MARGIN : 0;
+    const uint16_t x_end = nes->window.x_end < NES_SCREEN_WIDTH - NTSC_PIXEL_MARGIN ? nes->window.x_end + NTSC_PIXEL_MARGIN : NES_SCREEN_WIDTH;
+
+    // pixel x starts at phase (2x + line + frame) % 3
+    uint8_t phase = ((x_start * 2) + line + nes->ntsc_phase) % 3;
+
+    for (uint16_t x = x_start; x < x_end; ++x)
+    {
+        const int32_t (*kernel)[4] = ntsc->kernel[phase][offset + colour[x]];
+        int32_t (*dst)[4] = acc + (x * 2);
+
+#if NES_SSE2
+        for (uint8_t d = 0; d < NES_NTSC_KERNEL_SIZE; ++d)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i*)dst[d]);
+            const __m128i k = _mm_loadu_si128((const __m128i*)kernel[d]);
+
+            _mm_storeu_si128((__m128i*)dst[d], _mm_add_epi32(a, k));
+        }
+#else
+        for (uint8_t d = 0; d < NES_NTSC_KERNEL_SIZE; ++d)
+        {
+            dst[d][0] += kernel[d][0];
+            dst[d][1] += kernel[d][1];
+            dst[d][2] += kernel[d][2];
+        }
+#endif
+
+        phase = (phase + 2) % 3;
+    }
+
+    int32_t (*src)[4] = acc + NTSC_KERNEL_OFFSET;
+
+#if NES_SSE2
+    const __m128i alpha = _mm_set1_epi32((int32_t)0xFF000000);
+
+    for (uint16_t x = out_start; x < out_end; x += 2)
+    {
+        const __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)src[x + 0]), 8);
+        const __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)src[x + 1]), 8);
+
+        // clamps to 0-255 on the way down to bytes
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_setzero_si128());
+
+        _mm_storel_epi64((__m128i*)(out + x), _mm_or_si128(packed, alpha));
+    }
+#else
+    for (uint16_t x = out_start; x < out_end; ++x)
+    {
+        uint32_t pixel = 0xFF000000;
+
+        for (uint8_t i = 0; i < 3; ++i)
+        {
+            const int32_t v = src[x][i] >> 8;
+
+            pixel |= (uint32_t)(v < 0 ? 0 : v > 255 ? 255 : v) << (i * 8);
+        }
+
+        out[x] = pixel;
+    }
+#endif
+}
+
+void nes_ntsc_end_frame(struct NES_Core* nes)
+{
+    if (nes->pixel_format != NES_PIXEL_FORMAT_NTSC || nes->ntsc->no_crawl)
+    {
+        return;
+    }
+
+    // the skipped dot on odd frames means the carrier alternates between
+    // 2 phases each frame, which is the dot crawl.
+    nes->ntsc_phase ^= 1;
+
+#if NES_THREADS
+    // the workers are idle during vblank
+    if (nes->render_thread)
+    {
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            nes->render_thread->workers[i].core.ntsc_phase = nes->ntsc_phase;
+        }
+    }
+#endif
+}
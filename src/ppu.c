@@ -2,8 +2,20 @@
 #include "internal.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
+#if NES_SSE2
+    #include <emmintrin.h>
+#endif
+
+enum
+{
+    // frames that fine sync stays on for after a raster effect, so it
+    // covers the whole of the next frame.
+    PPU_FINE_SYNC_FRAMES = 2,
+};
+
 
 uint8_t ctrl_get_vram_addr(const struct NES_Core* nes)
 {
@@ -15,6 +27,11 @@ uint8_t ctrl_get_nmi(const struct NES_Core* nes)
     return (nes->ppu.ctrl >> 7) & 0x01;
 }
 
+uint8_t mask_get_greyscale(const struct NES_Core* nes)
+{
+    return (nes->ppu.mask >> 0) & 0x01;
+}
+
 uint8_t mask_get_bg_leftmost(const struct NES_Core* nes)
 {
     return (nes->ppu.mask >> 1) & 0x01;
@@ -88,27 +105,52 @@ static uint8_t ppu_get_sprite_size(const struct NES_Core* nes)
     return IS_BIT_SET(nes->ppu.ctrl, 5) ? 16 : 8;
 }
 
-// nametable is 0x3C0 bytes, then 0x40 bytes of attributes
-struct BgAttribute
+// which of the 2 vram nametables the pointer is in, or -1 if it
+// isn't pointing to vram at all.
+static FORCE_INLINE int8_t ppu_get_vram_page(const struct NES_Core* nes, const uint8_t* ptr)
 {
-    uint8_t upper_left  /*: 2*/;
-    uint8_t upper_right /*: 2*/;
-    uint8_t lower_left  /*: 2*/;
-    uint8_t lower_right /*: 2*/;
-};
+    if (ptr >= nes->ppu.vram && ptr < nes->ppu.vram + sizeof(nes->ppu.vram))
+    {
+        return (ptr - nes->ppu.vram) >> 10;
+    }
+
+    return -1;
+}
+
+// nametable is 0x3C0 bytes, then 0x40 bytes of attributes.
+// each attribute byte sets the palette of a 4x4 tile area, 2-bits
+// for each 2x2 quarter:
+// bit 0-1 = upper left
+// bit 2-3 = upper right
+// bit 4-5 = lower left
+// bit 6-7 = lower right
+static void ppu_update_attr_map(struct NES_Core* nes, uint8_t page, uint8_t attr_index, uint8_t value)
+{
+    const uint8_t row = (attr_index >> 3) * 4;
+    const uint8_t col = (attr_index & 7) * 4;
+
+    for (uint8_t y = 0; y < 4; ++y)
+    {
+        // the last row of attributes only covers 2 rows of tiles
+        if (row + y >= 30)
+        {
+            break;
+        }
+
+        uint8_t* map = &nes->ppu.attr_map[page][row + y][col];
+        const uint8_t shift = (y >> 1) * 4;
+
+        map[0] = map[1] = (value >> (shift + 0)) & 0x3;
+        map[2] = map[3] = (value >> (shift + 2)) & 0x3;
+
+        nes->ppu.nametable_row_gen[page][row + y] = ++nes->ppu.gen;
+    }
+}
 
-// as its 64 bytes next to each other for attr data,
-// could use simd to set all the data into the array
-// static FORCE_INLINE struct BgAttribute gen_bg_attr(const uint8_t v)
-// {
-//     return (struct BgAttribute)
-//     {
-//         .upper_left   = (v >> 0) & 0x3,
-//         .upper_right  = (v >> 2) & 0x3,
-//         .lower_left   = (v >> 4) & 0x3,
-//         .lower_right  = (v >> 6) & 0x3
-//     };
-// }
+void nes_ppu_chr_changed(struct NES_Core* nes)
+{
+    nes->ppu.chr_gen = ++nes->ppu.gen;
+}
 
 struct ObjAttribute
 {
@@ -120,6 +162,7 @@ struct ObjAttribute
 
 struct Obj
 {
+    uint8_t oam_index;
     uint8_t y;
     uint8_t n;
     struct ObjAttribute a;
@@ -146,56 +189,243 @@ static FORCE_INLINE struct ObjAttribute gen_ob_attr(const uint8_t v)
     };
 }
 
-static struct Sprites sprite_fetch(struct NES_Core* nes)
+static FORCE_INLINE struct Obj gen_obj(const struct NES_Core* nes, uint8_t oam_index, uint16_t pattern_table_addr, uint8_t sprite_size)
+{
+    const uint8_t* oam = &nes->ppu.oam[oam_index * 4];
+
+    struct Obj sprite =
+    {
+        .y = oam[0],
+        .n = oam[1],
+        .a = gen_ob_attr(oam[2]),
+        .x = oam[3],
+        .oam_index = oam_index,
+        .sprite0 = oam_index == 0,
+    };
+
+    if (sprite_size == 8)
+    {
+        sprite.pattern_table_base = pattern_table_addr;
+    }
+    else
+    {
+        sprite.pattern_table_base = sprite.n & 0x1 ? 0x1000 : 0x0000;
+        sprite.n &= ~0x1;
+    }
+
+    return sprite;
+}
+
+static FORCE_INLINE uint8_t bit_count64(uint64_t v)
+{
+#if HAS_BUILTIN(__builtin_popcountll)
+    return __builtin_popcountll(v);
+#else
+    uint8_t count = 0;
+    for (; v; v &= v - 1)
+    {
+        ++count;
+    }
+    return count;
+#endif
+}
+
+static FORCE_INLINE uint8_t bit_lowest64(uint64_t v)
+{
+#if HAS_BUILTIN(__builtin_ctzll)
+    return __builtin_ctzll(v);
+#else
+    uint8_t bit = 0;
+    for (; !(v & 1); v >>= 1)
+    {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+// returns a mask with bit N set if sprite N is on the line.
+static FORCE_INLINE uint64_t oam_line_mask(const uint8_t* sprite_y, uint8_t line, uint8_t sprite_size)
+{
+    uint64_t mask = 0;
+
+#if NES_SSE2
+    const __m128i ly = _mm_set1_epi8((char)line);
+    const __m128i max_row = _mm_set1_epi8((char)(sprite_size - 1));
+
+    for (uint8_t i = 0; i < 64; i += 16)
+    {
+        const __m128i y = _mm_loadu_si128((const __m128i*)(sprite_y + i));
+        // row = ly - y, in range if (ly >= y) && (row <= size - 1)
+        const __m128i row = _mm_sub_epi8(ly, y);
+        const __m128i below = _mm_cmpeq_epi8(_mm_max_epu8(ly, y), ly);
+        const __m128i inside = _mm_cmpeq_epi8(_mm_min_epu8(row, max_row), row);
+
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_and_si128(below, inside)) << i;
+    }
+#else
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        if (line >= sprite_y[i] && line < (sprite_y[i] + sprite_size))
+        {
+            mask |= (uint64_t)1 << i;
+        }
+    }
+#endif
+
+    return mask;
+}
+
+// builds the sprite list for every visible line.
+static void oam_eval(struct NES_Core* nes)
+{
+    const uint8_t sprite_size = ppu_get_sprite_size(nes);
+    uint8_t sprite_y[64];
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        sprite_y[i] = nes->ppu.oam[i * 4];
+    }
+
+    for (uint16_t line = 0; line < NES_SCREEN_HEIGHT; ++line)
+    {
+        uint64_t mask = oam_line_mask(sprite_y, line, sprite_size);
+        const uint8_t count = bit_count64(mask);
+
+        nes->ppu.oam_line_count[line] = count;
+
+        // only 8 sprites per line, lowest oam index first!
+        for (uint8_t i = 0; i < count && i < 8; ++i)
+        {
+            nes->ppu.oam_line_list[line][i] = bit_lowest64(mask);
+            mask &= mask - 1;
+        }
+    }
+
+    nes->ppu.oam_dirty = false;
+}
+
+static FORCE_INLINE void oam_eval_if_dirty(struct NES_Core* nes)
+{
+    if (UNLIKELY(nes->ppu.oam_dirty))
+    {
+        oam_eval(nes);
+    }
+}
+
+static struct Sprites sprite_fetch(struct NES_Core* nes, uint8_t line)
 {
     struct Sprites sprites = {0};
     
     // this is ignored if 8x16
     const uint16_t pattern_table_addr = ppu_get_obj_pattern_table_addr(nes);
     const uint8_t sprite_size = ppu_get_sprite_size(nes);
-    const uint8_t ly = nes->ppu.scanline;
 
-    for (size_t i = 0; i < ARRAY_SIZE(nes->ppu.oam); i += 4)
+    oam_eval_if_dirty(nes);
+
+    sprites.count = MIN(nes->ppu.oam_line_count[line], 8);
+
+    for (uint8_t i = 0; i < sprites.count; ++i)
     {
-        const uint8_t sprite_y = nes->ppu.oam[i];
+        sprites.sprite[i] = gen_obj(nes, nes->ppu.oam_line_list[line][i], pattern_table_addr, sprite_size);
+    }
 
-        // check if the y is in bounds!
-        if (ly >= sprite_y && ly < (sprite_y + sprite_size))
-        {
-            // only 8 sprites per line!
-            if (sprites.count < 8)
-            {
-                struct Obj* sprite = &sprites.sprite[sprites.count];
+    return sprites;
+}
 
-                sprite->y = sprite_y;
-                sprite->n = nes->ppu.oam[i + 1];
-                sprite->a = gen_ob_attr(nes->ppu.oam[i + 2]);
-                sprite->x = nes->ppu.oam[i + 3];
-                sprite->sprite0 = i == 0;
+#define BIT_REVERSE2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define BIT_REVERSE4(n) BIT_REVERSE2(n), BIT_REVERSE2(n + 2 * 16), BIT_REVERSE2(n + 1 * 16), BIT_REVERSE2(n + 3 * 16)
+#define BIT_REVERSE6(n) BIT_REVERSE4(n), BIT_REVERSE4(n + 2 * 4), BIT_REVERSE4(n + 1 * 4), BIT_REVERSE4(n + 3 * 4)
 
-                if (sprite_size == 8)
-                {
-                    sprite->pattern_table_base = pattern_table_addr;
-                }
-                else
-                {
-                    sprite->pattern_table_base = sprite->n & 0x1 ? 0x1000 : 0x0000;
-                    sprite->n &= ~0x1;
-                }
-                
-                ++sprites.count;
-            }
-            // we have to keep looping through oam in order to check
-            // if there were any lost sprites on this line!
-            else
-            {
-                status_set_obj_overflow(nes, true);
-                break;
-            }
+static const uint8_t BIT_REVERSE_TABLE[256] =
+{
+    BIT_REVERSE6(0), BIT_REVERSE6(2), BIT_REVERSE6(1), BIT_REVERSE6(3)
+};
+
+#undef BIT_REVERSE2
+#undef BIT_REVERSE4
+#undef BIT_REVERSE6
+
+// combines the 2 bit planes into 8 2-bit pixels, pixel 0 is the top 2 bits
+static FORCE_INLINE uint16_t obj_cache_decode_row(uint8_t lo, uint8_t hi)
+{
+    uint16_t row = 0;
+
+    for (uint8_t x = 0; x < 8; ++x)
+    {
+        const uint8_t bit = 7 - x;
+
+        row |= ((IS_BIT_SET(hi, bit) << 1) | IS_BIT_SET(lo, bit)) << (14 - (x * 2));
+    }
+
+    return row;
+}
+
+static void obj_cache_decode_tile(struct NES_Core* nes, uint16_t tile)
+{
+    struct NES_ObjCache* cache = &nes->obj_cache;
+
+    for (uint8_t row = 0; row < 8; ++row)
+    {
+        const uint8_t lo = nes_ppu_read(nes, (tile * 16) + row + 0);
+        const uint8_t hi = nes_ppu_read(nes, (tile * 16) + row + 8);
+
+        cache->rows[tile][row][0] = obj_cache_decode_row(lo, hi);
+        cache->rows[tile][row][1] = obj_cache_decode_row(BIT_REVERSE_TABLE[lo], BIT_REVERSE_TABLE[hi]);
+    }
+
+    cache->gen[tile] = nes->ppu.gen;
+}
+
+// returns the row of pixels at the pattern address, flipped if needed.
+// the cache is invalidated by the same chr changes as the bg cache.
+static FORCE_INLINE uint16_t obj_cache_get_row(struct NES_Core* nes, uint16_t pattern_addr, bool xflip)
+{
+    const uint16_t tile = (pattern_addr >> 4) & 0x1FF;
+    const uint32_t gen = nes->obj_cache.gen[tile];
+
+    if (UNLIKELY(gen == 0 || gen < nes->ppu.chr_gen))
+    {
+        obj_cache_decode_tile(nes, tile);
+    }
+
+    return nes->obj_cache.rows[tile][pattern_addr & 0x7][xflip];
+}
+
+uint16_t nes_ppu_pattern_row(struct NES_Core* nes, uint16_t pattern_addr, bool xflip)
+{
+    return obj_cache_get_row(nes, pattern_addr, xflip);
+}
+
+// returns the address of the low bit plane for the row of the sprite
+// that is on the line.
+static FORCE_INLINE uint16_t sprite_get_pattern_addr(const struct Obj* sprite, uint8_t line, uint8_t sprite_size)
+{
+    uint16_t pattern_index = sprite->pattern_table_base + (sprite->n * 16);
+    
+    // check if the sprite is upside down
+    if (sprite->a.yflip)
+    {
+        pattern_index += 7 - ((line - sprite->y) & 0x7);
+    
+        // check if we are on the next row
+        if (sprite_size == 16 && (line - sprite->y) < 8)
+        {
+            pattern_index += 16;
+        }
+    }
+    else
+    {
+        pattern_index += ((line - sprite->y) & 0x7);
+    
+        // check if we are on the next row
+        if (sprite_size == 16 && (line - sprite->y) >= 8)
+        {
+            pattern_index += 16;
         }
     }
 
-    return sprites;
+    return pattern_index;
 }
 
 // SOURCE: https://problemkaputt.de/everynes.htm#memorymaps
@@ -256,11 +486,42 @@ void nes_ppu_write(struct NES_Core* nes, uint16_t addr, uint8_t value)
 {
     assert(addr <= 0x3FFF);
 
+    NES_RENDER_LOG(nes, RENDER_EVENT_PPU_WRITE, value, addr);
+
     if (LIKELY(addr <= 0x3EFF))
     {
-        if (LIKELY(nes->ppu.write_map[addr >> 10] != NULL))
+        uint8_t* ptr = nes->ppu.write_map[addr >> 10];
+
+        // rewriting the same value is common (such as re-uploading a
+        // status bar each frame), skip these so the bg cache stays valid.
+        if (LIKELY(ptr != NULL) && ptr[addr & 0x3FF] != value)
         {
-            nes->ppu.write_map[addr >> 10][addr & 0x3FF] = value;
+            ptr[addr & 0x3FF] = value;
+
+            // chr ram
+            if (addr < 0x2000)
+            {
+                nes_ppu_chr_changed(nes);
+            }
+            else
+            {
+                const int8_t page = ppu_get_vram_page(nes, ptr);
+                const uint16_t offset = addr & 0x3FF;
+
+                if (UNLIKELY(page < 0))
+                {
+                    nes_ppu_chr_changed(nes);
+                }
+                // keep the attribute map in sync
+                else if (offset >= 0x3C0)
+                {
+                    ppu_update_attr_map(nes, page, offset & 0x3F, value);
+                }
+                else
+                {
+                    nes->ppu.nametable_row_gen[page][offset >> 5] = ++nes->ppu.gen;
+                }
+            }
         }
     }
     else
@@ -285,164 +546,320 @@ void nes_dma(struct NES_Core* nes)
     for (uint16_t i = 0; i < 0x100; i++)
     {
         nes->ppu.oam[i] = nes_cpu_read(nes, addr | i);
+        NES_RENDER_LOG(nes, RENDER_EVENT_OAM_WRITE, nes->ppu.oam[i], i);
+    }
+
+    nes->ppu.oam_dirty = true;
+}
+
+// same as i used in dmg / gbc / sms
+struct PriorityBuf
+{
+    uint8_t pal[NES_SCREEN_WIDTH];
+};
+
+// palette ram index (0x00-0x1F) for each pixel of the line.
+// this is filled by the bg and obj renderer, then converted to
+// colours once the whole line is done.
+struct LineBuf
+{
+    uint8_t pram[NES_SCREEN_WIDTH];
+};
+
+// pram entries 0x10, 0x14, 0x18, 0x1C are mirrors of 0x00, 0x04...
+static FORCE_INLINE uint8_t ppu_get_pram_colour(const struct NES_Core* nes, uint8_t index)
+{
+    if ((index & 0x13) == 0x10)
+    {
+        index -= 0x10;
     }
+
+    return nes->ppu.pram[index] & 0x3F;
 }
 
-// this is kinda slow, but allows but any pixel format to be set.
-// this could be a compile-time option instead, with the default being u32
-static FORCE_INLINE void ppu_write_pixel(struct NES_Core* nes, uint32_t c, uint16_t x, uint16_t y)
+// writes the colours of the line using the palette from NES_set_palette()
+static FORCE_INLINE void ppu_write_line(struct NES_Core* nes, uint8_t line, const uint32_t* pal)
 {
+    const uint8_t* colour = nes->frame_colour[line];
+    const uint16_t x_start = nes->window.x_start;
+    const uint16_t x_end = nes->window.x_end;
+
     switch (nes->bpp)
     {
-        case 8:
-            ((uint8_t*)nes->pixels)[nes->pixels_stride * y + x] = c;
-            break;
+        case 8: {
+            uint8_t* p = (uint8_t*)nes->pixels + nes->pixels_stride * line;
+            for (uint16_t x = x_start; x < x_end; ++x)
+            {
+                p[x] = pal[colour[x]];
+            }
+        } break;
 
         case 15:
-        case 16:
-            ((uint16_t*)nes->pixels)[nes->pixels_stride * y + x] = c;
-            break;
+        case 16: {
+            uint16_t* p = (uint16_t*)nes->pixels + nes->pixels_stride * line;
+            for (uint16_t x = x_start; x < x_end; ++x)
+            {
+                p[x] = pal[colour[x]];
+            }
+        } break;
 
         case 24:
-        case 32:
-            ((uint32_t*)nes->pixels)[nes->pixels_stride * y + x] = c;
-            break;
+        case 32: {
+            uint32_t* p = (uint32_t*)nes->pixels + nes->pixels_stride * line;
+            for (uint16_t x = x_start; x < x_end; ++x)
+            {
+                p[x] = pal[colour[x]];
+            }
+        } break;
     }
 }
 
-static FORCE_INLINE uint32_t get_colour_from_palette(struct NES_Core* nes, uint8_t palette, uint8_t colour_id)
+// averages each 2x2 block of the 2 rows from x_start to x_end (both
+// even), writing half the width.
+static FORCE_INLINE void ppu_chroma_subsample(uint8_t* out, const uint8_t* row0, const uint8_t* row1, uint16_t x_start, uint16_t x_end)
 {
-    const uint8_t offset = (palette * 4) + colour_id;
-    const uint8_t index = nes_ppu_read(nes, 0x3F00 | offset);//nes->ppu.pram[offset & 0x1F];
-    return nes->palette.colour[index & 0x3F];
-}
+    uint16_t x = x_start;
 
-// same as i used in dmg / gbc / sms
-struct PriorityBuf
-{
-    uint8_t pal[NES_SCREEN_WIDTH];
-};
+#if NES_SSE2
+    const __m128i lo_mask = _mm_set1_epi16(0x00FF);
+    const __m128i round = _mm_set1_epi16(2);
 
-static void render_scanline_bg(struct NES_Core* nes, uint8_t line, struct PriorityBuf* prio)
-{
-    const uint8_t row = (line >> 3) & 31;
-    const uint8_t fine_line = line & 7;
+    for (; x + 32 <= x_end; x += 32)
+    {
+        __m128i avg[2];
 
-    uint8_t scrollx = (nes->ppu.horizontal_scroll_origin >> 3) & 31;
-    const uint8_t fine_scrollx = nes->ppu.horizontal_scroll_origin & 0x7;
+        for (uint8_t i = 0; i < 2; ++i)
+        {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x + (i * 16)));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x + (i * 16)));
 
-    // uint8_t scrolly = (nes->ppu.vertical_scroll_origin >> 3) & 31;
-    const uint8_t fine_scrolly = nes->ppu.vertical_scroll_origin & 0x7;
+            // adds the even and odd pixels of both rows as 16-bit
+            const __m128i sum_a = _mm_add_epi16(_mm_and_si128(a, lo_mask), _mm_srli_epi16(a, 8));
+            const __m128i sum_b = _mm_add_epi16(_mm_and_si128(b, lo_mask), _mm_srli_epi16(b, 8));
 
-    const uint16_t pattern_table_addr = ppu_get_bg_pattern_table_addr(nes);
+            avg[i] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum_a, sum_b), round), 2);
+        }
 
-    uint16_t nametable_base_addr = ppu_get_nametable_addr(nes);
-    // uint16_t attr_table_addr = ppu_get_nametable_addr(nes) + (row * 4) + 0x3C0;
+        _mm_storeu_si128((__m128i*)(out + (x / 2)), _mm_packus_epi16(avg[0], avg[1]));
+    }
+#endif
 
-    // todo: attribute table
-    for (uint8_t col = 0; col < 32; ++col)
+    for (; x < x_end; x += 2)
     {
-        uint16_t horizontal_offset = 0;
-        uint16_t vertical_offset = 0;
-
-        horizontal_offset = scrollx;
-        vertical_offset = row * 32;
-
-        const uint16_t nametable_addr = nametable_base_addr + horizontal_offset + vertical_offset;
+        out[x / 2] = (row0[x] + row0[x + 1] + row1[x] + row1[x + 1] + 2) >> 2;
+    }
+}
 
-        if (scrollx == 31)
-        {
-            scrollx = 0;
-            nametable_base_addr ^= 0x400;
-        }
-        else
-        {
-            scrollx++;
-        }
+// writes the luma of the line, then once both lines of the chroma row
+// are done (odd lines), the chroma for the pair.
+static FORCE_INLINE void ppu_write_line_yuv420(struct NES_Core* nes, uint8_t line, uint16_t offset)
+{
+    const uint8_t* colour = nes->frame_colour[line];
+    const uint8_t* pal_y = nes->palette_yuv[0] + offset;
+    uint8_t* p = (uint8_t*)nes->pixels + nes->pixels_stride * line;
+    const uint16_t x_start = nes->window.x_start;
+    const uint16_t x_end = nes->window.x_end;
 
-        const uint8_t tile_num = nes_ppu_read(nes, nametable_addr);
-        // const uint8_t attr_byte = nes_ppu_read(nes, attr_table_addr++);
-        // const struct BgAttribute attr = gen_bg_attr(attr_byte);
+    for (uint16_t x = x_start; x < x_end; ++x)
+    {
+        p[x] = pal_y[colour[x]];
+    }
 
-        uint16_t palette_index_offset = pattern_table_addr;
+    if (!(line & 1))
+    {
+        return;
+    }
 
-        palette_index_offset += (fine_line + fine_scrolly) & 0x7;
+    // the previous line is always from this frame, unless the pixels
+    // were changed mid frame, in which case it's just the wrong colour.
+    const uint8_t* prev_colour = nes->frame_colour[line - 1];
+    const uint16_t prev_offset = (nes->frame_emphasis[line - 1] & 0x7) * 64;
+    uint8_t row0[NES_SCREEN_WIDTH];
+    uint8_t row1[NES_SCREEN_WIDTH];
 
-        const uint8_t bit_plane0 = nes_ppu_read(nes, palette_index_offset + (tile_num * 16) + 0);
-        const uint8_t bit_plane1 = nes_ppu_read(nes, palette_index_offset + (tile_num * 16) + 8);
+    for (uint8_t plane = 1; plane < 3; ++plane)
+    {
+        const uint8_t* pal = nes->palette_yuv[plane];
+        uint8_t* out = plane == 1 ? nes->pixels_u : nes->pixels_v;
 
-        for (uint8_t x = 0; x < 8; ++x)
+        for (uint16_t x = x_start; x < x_end; ++x)
         {
-            const uint8_t bit = 7 - x;
-
-            const int16_t x_index = (col * 8) + x - fine_scrollx;
+            row0[x] = pal[prev_offset + (prev_colour[x] & 0x3F)];
+            row1[x] = pal[offset + colour[x]];
+        }
 
-            if (x_index < 0 || x_index >= NES_SCREEN_WIDTH)
-            {
-                continue;
-            }
+        ppu_chroma_subsample(out + nes->pixels_uv_stride * (line >> 1), row0, row1, x_start, x_end);
+    }
+}
 
-            uint8_t palette_index = 0;
+// converts the line to colours, updating the frame diff and then
+// writing the line to the pixel buffer.
+// the switch on bpp is done once per line rather than per pixel, same
+// for greyscale and emphasis, which only change the lut and palette.
+void nes_ppu_output_line(struct NES_Core* nes, uint8_t line, const uint8_t* pram)
+{
+    const struct NES_RenderWindow* window = &nes->window;
 
-            palette_index |= IS_BIT_SET(bit_plane0, bit) << 0;
-            palette_index |= IS_BIT_SET(bit_plane1, bit) << 1;
+    if (line < window->line_start || line >= window->line_end)
+    {
+        return;
+    }
 
-            prio->pal[x_index] = palette_index;
+    uint8_t lut[32];
+    uint8_t* colour = nes->frame_colour[line];
+    uint32_t tiles = 0;
 
-            const uint32_t colour = get_colour_from_palette(nes, 0, palette_index);
+    uint16_t x_start = window->x_start;
+    uint16_t x_end = window->x_end;
 
-            ppu_write_pixel(nes, colour, x_index, line);
-        }
+    // the ntsc filter also needs the colours just outside the window
+    if (nes->pixel_format == NES_PIXEL_FORMAT_NTSC)
+    {
+        x_start = x_start > NTSC_PIXEL_MARGIN ? x_start - NTSC_PIXEL_MARGIN : 0;
+        x_end = x_end < NES_SCREEN_WIDTH - NTSC_PIXEL_MARGIN ? x_end + NTSC_PIXEL_MARGIN : NES_SCREEN_WIDTH;
     }
-}
 
-static void render_scanline_obj(struct NES_Core* nes, uint8_t line, const struct PriorityBuf* prio)
-{
-    const struct Sprites sprites = sprite_fetch(nes);
-    const uint8_t sprite_size = ppu_get_sprite_size(nes);
+    // greyscale only keeps the brightness (row) of the colour
+    const uint8_t grey = mask_get_greyscale(nes) ? 0x30 : 0x3F;
+    const uint8_t emphasis = mask_get_bgr(nes);
 
-    bool already_rendered[NES_SCREEN_WIDTH] = {0};
+    for (uint8_t i = 0; i < ARRAY_SIZE(lut); ++i)
+    {
+        lut[i] = ppu_get_pram_colour(nes, i) & grey;
+    }
 
-    for (uint8_t i = 0; i < sprites.count; ++i)
+    for (uint16_t x = x_start; x < x_end; ++x)
     {
-        const struct Obj* sprite = &sprites.sprite[i];
-    
-        uint16_t pattern_index = sprite->pattern_table_base + (sprite->n * 16);
-        
-        // check if the sprite is upside down
-        if (sprite->a.yflip)
-        {
-            pattern_index += 7 - ((line - sprite->y) & 0x7);
-        
-            // check if we are on the next row
-            if (sprite_size == 16 && (line - sprite->y) < 8)
+        const uint8_t c = lut[pram[x] & 0x1F];
+
+        if (colour[x] != c)
+        {
+            colour[x] = c;
+            tiles |= 1U << (x >> 3);
+        }
+    }
+
+    // every pixel changes colour when the emphasis does
+    if (nes->frame_emphasis[line] != emphasis)
+    {
+        nes->frame_emphasis[line] = emphasis;
+        tiles = 0xFFFFFFFF;
+    }
+
+    if (tiles)
+    {
+        nes->frame_diff.rows[line >> 5] |= 1U << (line & 31);
+        nes->frame_diff.tiles[line >> 3] |= tiles;
+    }
+
+    const uint16_t offset = emphasis * 64;
+
+    switch (nes->pixel_format)
+    {
+        case NES_PIXEL_FORMAT_PALETTE:
+            ppu_write_line(nes, line, nes->palette + offset);
+            break;
+
+        case NES_PIXEL_FORMAT_RGB565: {
+            const uint16_t* pal = nes->palette_rgb565 + offset;
+            uint16_t* p = (uint16_t*)nes->pixels + nes->pixels_stride * line;
+            for (uint16_t x = window->x_start; x < window->x_end; ++x)
             {
-                pattern_index += 16;
+                p[x] = pal[colour[x]];
             }
+        } break;
+
+        case NES_PIXEL_FORMAT_YUV420:
+            ppu_write_line_yuv420(nes, line, offset);
+            break;
+
+        case NES_PIXEL_FORMAT_NTSC:
+            nes_ntsc_line(nes, line, offset);
+            break;
+    }
+}
+
+// returns the palette of each tile on the row for the nametable at addr.
+// only vram nametables have an attr map, anything else (four screen,
+// or a mapper pointing it at cart memory) is decoded into scratch.
+static FORCE_INLINE const uint8_t* ppu_get_attr_row(const struct NES_Core* nes, uint16_t nametable_addr, uint8_t row, uint8_t scratch[32])
+{
+    const uint8_t* nametable = nes->ppu.read_map[nametable_addr >> 10];
+    const int8_t page = ppu_get_vram_page(nes, nametable);
+
+    if (LIKELY(page >= 0))
+    {
+        return nes->ppu.attr_map[page][row];
+    }
+
+    const uint8_t* attr = nametable + 0x3C0 + ((row >> 2) * 8);
+    const uint8_t shift = ((row >> 1) & 1) * 4;
+
+    for (uint8_t col = 0; col < 32; ++col)
+    {
+        scratch[col] = (attr[col >> 2] >> (shift + ((col >> 1) & 1) * 2)) & 0x3;
+    }
+
+    return scratch;
+}
+
+static void render_scanline_bg(struct NES_Core* nes, uint8_t line, struct PriorityBuf* prio, struct LineBuf* buf)
+{
+    const uint8_t row = (line >> 3) & 31;
+    const uint8_t fine_line = line & 7;
+
+    uint8_t scrollx = (nes->ppu.horizontal_scroll_origin >> 3) & 31;
+    const uint8_t fine_scrollx = nes->ppu.horizontal_scroll_origin & 0x7;
+
+    // uint8_t scrolly = (nes->ppu.vertical_scroll_origin >> 3) & 31;
+    const uint8_t fine_scrolly = nes->ppu.vertical_scroll_origin & 0x7;
+
+    const uint16_t pattern_table_addr = ppu_get_bg_pattern_table_addr(nes);
+
+    // a nametable row is 32 bytes next to each other, so the row is
+    // found once and then indexed directly, rather than going through
+    // nes_ppu_read() for every tile.
+    uint16_t nametable_base_addr = ppu_get_nametable_addr(nes);
+    const uint8_t* nametable_row = nes->ppu.read_map[nametable_base_addr >> 10] + (row * 32);
+    uint8_t attr_scratch[32];
+    const uint8_t* attr_row = ppu_get_attr_row(nes, nametable_base_addr, row, attr_scratch);
+
+    // 33 tiles are fetched as the fine x scroll can shift
+    // part of the last tile onto the screen.
+    for (uint8_t col = 0; col < 33; ++col)
+    {
+        const uint8_t tile_num = nametable_row[scrollx];
+        const uint8_t palette = attr_row[scrollx] * 4;
+
+        // wrap around to the next horizontal nametable
+        if (scrollx == 31)
+        {
+            scrollx = 0;
+            nametable_base_addr ^= 0x400;
+            nametable_row = nes->ppu.read_map[nametable_base_addr >> 10] + (row * 32);
+            attr_row = ppu_get_attr_row(nes, nametable_base_addr, row, attr_scratch);
         }
         else
         {
-            pattern_index += ((line - sprite->y) & 0x7);
-        
-            // check if we are on the next row
-            if (sprite_size == 16 && (line - sprite->y) >= 8)
-            {
-                pattern_index += 16;
-            }
+            scrollx++;
         }
 
-        const uint8_t bit_plane0 = nes_ppu_read(nes, pattern_index + 0);
-        const uint8_t bit_plane1 = nes_ppu_read(nes, pattern_index + 8);
+        uint16_t palette_index_offset = pattern_table_addr;
+
+        palette_index_offset += (fine_line + fine_scrolly) & 0x7;
+
+        const uint8_t bit_plane0 = nes_ppu_read(nes, palette_index_offset + (tile_num * 16) + 0);
+        const uint8_t bit_plane1 = nes_ppu_read(nes, palette_index_offset + (tile_num * 16) + 8);
 
         for (uint8_t x = 0; x < 8; ++x)
         {
-            const uint8_t bit = sprite->a.xflip ? x : 7 - x;
+            const uint8_t bit = 7 - x;
 
-            const uint16_t x_index = sprite->x + x;
+            const int16_t x_index = (col * 8) + x - fine_scrollx;
 
-            if (x_index >= NES_SCREEN_WIDTH)
+            if (x_index < 0 || x_index >= NES_SCREEN_WIDTH)
             {
-                break;
+                continue;
             }
 
             uint8_t palette_index = 0;
@@ -450,17 +867,140 @@ static void render_scanline_obj(struct NES_Core* nes, uint8_t line, const struct
             palette_index |= IS_BIT_SET(bit_plane0, bit) << 0;
             palette_index |= IS_BIT_SET(bit_plane1, bit) << 1;
 
-            // transparent
-            if (palette_index == 0)
+            prio->pal[x_index] = palette_index;
+            // colour 0 of every bg palette is the backdrop
+            buf->pram[x_index] = palette_index ? palette + palette_index : 0;
+        }
+    }
+}
+
+// returns true if nothing that the bg of the line depends on has
+// changed since it was cached.
+static bool bg_cache_is_valid(const struct NES_Core* nes, uint8_t line)
+{
+    const struct NES_BgCache* cache = &nes->bg_cache;
+    const uint32_t gen = cache->gen[line];
+
+    if (gen == 0 || gen < nes->ppu.chr_gen)
+    {
+        return false;
+    }
+
+    if (cache->scroll_x[line] != nes->ppu.horizontal_scroll_origin ||
+        cache->scroll_y[line] != nes->ppu.vertical_scroll_origin ||
+        cache->ctrl[line] != (nes->ppu.ctrl & 0x13))
+    {
+        return false;
+    }
+
+    // the line uses the row from both horizontal nametables
+    const uint8_t row = line >> 3;
+    const uint16_t nametable_addr = ppu_get_nametable_addr(nes);
+    const int8_t page0 = ppu_get_vram_page(nes, nes->ppu.read_map[(nametable_addr >> 10) ^ 0]);
+    const int8_t page1 = ppu_get_vram_page(nes, nes->ppu.read_map[(nametable_addr >> 10) ^ 1]);
+
+    if (page0 < 0 || page1 < 0)
+    {
+        return false;
+    }
+
+    return gen >= nes->ppu.nametable_row_gen[page0][row] && gen >= nes->ppu.nametable_row_gen[page1][row];
+}
+
+// fills the line with the bg, reusing last frame's line if possible.
+static void render_scanline_bg_cached(struct NES_Core* nes, uint8_t line, struct PriorityBuf* prio, struct LineBuf* buf)
+{
+    struct NES_BgCache* cache = &nes->bg_cache;
+
+    if (bg_cache_is_valid(nes, line))
+    {
+        memcpy(buf->pram, cache->pram[line], sizeof(buf->pram));
+
+        // the bg colour is the low 2 bits of the pram index
+        for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+        {
+            prio->pal[x] = buf->pram[x] & 0x3;
+        }
+    }
+    else
+    {
+        render_scanline_bg(nes, line, prio, buf);
+
+        memcpy(cache->pram[line], buf->pram, sizeof(buf->pram));
+        cache->gen[line] = nes->ppu.gen;
+        cache->scroll_x[line] = nes->ppu.horizontal_scroll_origin;
+        cache->scroll_y[line] = nes->ppu.vertical_scroll_origin;
+        cache->ctrl[line] = nes->ppu.ctrl & 0x13;
+    }
+}
+
+// adds the row of the sprite on the line to this frame's sprite list
+static void layers_add_obj(struct NES_Core* nes, const struct Obj* sprite, uint8_t line)
+{
+    struct NES_LayerObj* obj = &nes->layer_objs[sprite->oam_index];
+    const uint64_t bit = 1ULL << sprite->oam_index;
+
+    if (!(nes->layer_objs_seen & bit))
+    {
+        nes->layer_objs_seen |= bit;
+
+        *obj = (struct NES_LayerObj)
+        {
+            .oam_index = sprite->oam_index,
+            .x = sprite->x,
+            .y = sprite->y,
+            .tile = nes->ppu.oam[(sprite->oam_index * 4) + 1],
+            .palette = sprite->a.palette,
+            .xflip = sprite->a.xflip,
+            .yflip = sprite->a.yflip,
+            .bg_prio = sprite->a.bg_prio,
+        };
+    }
+
+    obj->rows |= 1U << ((line - sprite->y) & 0xF);
+}
+
+static void render_scanline_obj(struct NES_Core* nes, uint8_t line, const struct PriorityBuf* prio, struct LineBuf* buf)
+{
+    const struct Sprites sprites = sprite_fetch(nes, line);
+    const uint8_t sprite_size = ppu_get_sprite_size(nes);
+    uint8_t* obj_layer = nes->layers ? nes->layers->obj[line] : NULL;
+
+    bool already_rendered[NES_SCREEN_WIDTH] = {0};
+
+    for (uint8_t i = 0; i < sprites.count; ++i)
+    {
+        const struct Obj* sprite = &sprites.sprite[i];
+    
+        const uint16_t pattern_index = sprite_get_pattern_addr(sprite, line, sprite_size);
+        const uint16_t row = obj_cache_get_row(nes, pattern_index, sprite->a.xflip);
+
+        if (UNLIKELY(obj_layer != NULL))
+        {
+            layers_add_obj(nes, sprite, line);
+        }
+
+        // fully transparent
+        if (row == 0)
+        {
+            continue;
+        }
+
+        for (uint8_t x = 0; x < 8; ++x)
+        {
+            const uint16_t x_index = sprite->x + x;
+
+            if (x_index >= NES_SCREEN_WIDTH)
             {
-                continue;
+                break;
             }
 
-            // set if oam[0] is being rendered over pal 1-3 bg.
-            // it does not care for bg priority!
-            if (sprite->sprite0 && prio->pal[x_index] != 0)
+            const uint8_t palette_index = (row >> (14 - (x * 2))) & 0x3;
+
+            // transparent
+            if (palette_index == 0)
             {
-                status_set_obj_hit(nes, true);
+                continue;
             }
 
             // skip if sprite has already been rendered
@@ -473,69 +1013,448 @@ static void render_scanline_obj(struct NES_Core* nes, uint8_t line, const struct
             // this is set regardless of bg priority!
             already_rendered[x_index] = true;
 
+            if (UNLIKELY(obj_layer != NULL))
+            {
+                obj_layer[x_index] = 0x10 + (sprite->a.palette * 4) + palette_index;
+            }
+
             // skip if sprite is behind bg AND bg is transparent
             if (sprite->a.bg_prio && prio->pal[x_index] != 0)
             {
                 continue;
             }
 
-            const uint32_t colour = get_colour_from_palette(nes, 4 + sprite->a.palette, palette_index);
-
-            ppu_write_pixel(nes, colour, x_index, line);
+            buf->pram[x_index] = 0x10 + (sprite->a.palette * 4) + palette_index;
         }
     }
 }
 
 static void render_scanline(struct NES_Core* nes, int line)
 {
-    if (line >= 240 || line < 0)
+    if (line >= nes->window.line_end || line < nes->window.line_start)
     {
         return;
     }
 
     struct PriorityBuf prio = {0};
+    // defaults to the backdrop colour (pram 0x00)
+    struct LineBuf buf = {0};
 
     if (mask_get_bg_on(nes))
     {
-        render_scanline_bg(nes, line, &prio);
+        render_scanline_bg_cached(nes, line, &prio, &buf);
+    }
+
+    if (UNLIKELY(nes->layers != NULL))
+    {
+        memcpy(nes->layers->bg[line], buf.pram, sizeof(buf.pram));
+        memset(nes->layers->obj[line], 0, sizeof(nes->layers->obj[line]));
     }
 
     if (mask_get_obj_on(nes))
     {
-        render_scanline_obj(nes, line, &prio);
+        render_scanline_obj(nes, line, &prio, &buf);
+    }
+
+    nes_ppu_output_line(nes, line, buf.pram);
+}
+
+#if NES_THREADS
+void nes_ppu_render_line(struct NES_Core* nes, uint8_t line)
+{
+    render_scanline(nes, line);
+}
+#endif // NES_THREADS
+
+// writes the first count pixels of a decoded row as pram indices
+static FORCE_INLINE void render_tile_bits(uint8_t* out, uint16_t bits, uint8_t palette, uint8_t count)
+{
+    for (uint8_t x = 0; x < count; ++x)
+    {
+        const uint8_t palette_index = (bits >> (14 - (x * 2))) & 0x3;
+
+        // colour 0 of every bg palette is the backdrop
+        out[x] = palette_index ? palette + palette_index : 0;
+    }
+}
+
+// fills the bg cache for the 8 lines of the tile row. this gives the
+// same result as render_scanline_bg() for each line, but each tile is
+// only looked up once, and its rows come already decoded from the obj
+// cache.
+static void render_tile_row_bg(struct NES_Core* nes, uint8_t row)
+{
+    struct NES_BgCache* cache = &nes->bg_cache;
+
+    uint8_t scrollx = (nes->ppu.horizontal_scroll_origin >> 3) & 31;
+    const uint8_t fine_scrollx = nes->ppu.horizontal_scroll_origin & 0x7;
+    const uint8_t fine_scrolly = nes->ppu.vertical_scroll_origin & 0x7;
+
+    const uint16_t pattern_table_addr = ppu_get_bg_pattern_table_addr(nes);
+
+    uint16_t nametable_base_addr = ppu_get_nametable_addr(nes);
+    const uint8_t* nametable_row = nes->ppu.read_map[nametable_base_addr >> 10] + (row * 32);
+    uint8_t attr_scratch[32];
+    const uint8_t* attr_row = ppu_get_attr_row(nes, nametable_base_addr, row, attr_scratch);
+
+    for (uint8_t col = 0; col < 33; ++col)
+    {
+        const uint8_t tile_num = nametable_row[scrollx];
+        const uint8_t palette = attr_row[scrollx] * 4;
+
+        // wrap around to the next horizontal nametable
+        if (scrollx == 31)
+        {
+            scrollx = 0;
+            nametable_base_addr ^= 0x400;
+            nametable_row = nes->ppu.read_map[nametable_base_addr >> 10] + (row * 32);
+            attr_row = ppu_get_attr_row(nes, nametable_base_addr, row, attr_scratch);
+        }
+        else
+        {
+            scrollx++;
+        }
+
+        const int16_t x_start = (col * 8) - fine_scrollx;
+        const uint16_t pattern_addr = pattern_table_addr + (tile_num * 16);
+
+        for (uint8_t y = 0; y < 8; ++y)
+        {
+            const uint16_t bits = obj_cache_get_row(nes, pattern_addr + ((y + fine_scrolly) & 0x7), false);
+            uint8_t* out = cache->pram[(row * 8) + y];
+
+            // only the first and last tile can be partly off screen
+            if (x_start >= 0 && x_start <= NES_SCREEN_WIDTH - 8)
+            {
+                render_tile_bits(out + x_start, bits, palette, 8);
+            }
+            else if (x_start < 0)
+            {
+                render_tile_bits(out, bits << (-x_start * 2), palette, 8 + x_start);
+            }
+            else
+            {
+                render_tile_bits(out + x_start, bits, palette, NES_SCREEN_WIDTH - x_start);
+            }
+        }
+    }
+
+    for (uint8_t y = 0; y < 8; ++y)
+    {
+        const uint8_t line = (row * 8) + y;
+
+        cache->gen[line] = nes->ppu.gen;
+        cache->scroll_x[line] = nes->ppu.horizontal_scroll_origin;
+        cache->scroll_y[line] = nes->ppu.vertical_scroll_origin;
+        cache->ctrl[line] = nes->ppu.ctrl & 0x13;
+    }
+}
+
+// renders the lines with nothing having changed since they were done.
+// the bg is brought up to date a tile row at a time, after which each
+// line is just the cached bg with the sprites on top.
+static void render_tiles(struct NES_Core* nes, uint8_t start, uint8_t end)
+{
+    start = start > nes->window.line_start ? start : nes->window.line_start;
+    end = end < nes->window.line_end ? end : nes->window.line_end;
+
+    if (start >= end)
+    {
+        return;
+    }
+
+    if (mask_get_bg_on(nes))
+    {
+        for (uint8_t row = start >> 3; row <= ((end - 1) >> 3); ++row)
+        {
+            const uint8_t first = row * 8 > start ? row * 8 : start;
+            const uint8_t last = (row * 8) + 8 < end ? (row * 8) + 8 : end;
+
+            for (uint8_t line = first; line < last; ++line)
+            {
+                if (!bg_cache_is_valid(nes, line))
+                {
+                    render_tile_row_bg(nes, row);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (uint8_t line = start; line < end; ++line)
+    {
+        render_scanline(nes, line);
+    }
+}
+
+void nes_ppu_tile_flush(struct NES_Core* nes)
+{
+    if (!nes->ppu.tile_frame || nes->ppu.tile_end == nes->ppu.tile_start)
+    {
+        return;
+    }
+
+    if (nes->pixels)
+    {
+        render_tiles(nes, nes->ppu.tile_start, nes->ppu.tile_end);
+    }
+
+    nes->ppu.tile_start = nes->ppu.tile_end;
+}
+
+void nes_ppu_tile_stop(struct NES_Core* nes)
+{
+    nes_ppu_tile_flush(nes);
+    nes->ppu.tile_frame = false;
+}
+
+void nes_ppu_tile_write(struct NES_Core* nes)
+{
+    // writes before the first line is done apply to the whole frame, so
+    // only writes after that are raster effects.
+    if (nes->ppu.tile_frame && nes->ppu.tile_end)
+    {
+        nes_ppu_tile_stop(nes);
+    }
+}
+
+static FORCE_INLINE void ppu_render_line(struct NES_Core* nes, int line)
+{
+#if NES_THREADS
+    // the render thread renders the line once it reaches it in the log
+    if (nes->render_thread)
+    {
+        if (line >= 0 && line < 240)
+        {
+            nes_render_thread_log_line(nes, line);
+        }
+        return;
+    }
+#endif
+
+    render_scanline(nes, line);
+}
+
+// sprite 0 hit and sprite overflow are the only results of rendering
+// that the cpu can see. these are worked out at the start of each line
+// whether or not the line is actually rendered, so that running without
+// pixels (headless) behaves exactly the same as running with them.
+static void ppu_eval_line(struct NES_Core* nes, uint8_t line)
+{
+    nes->ppu.obj_hit_cycle = -1;
+
+    if (!mask_get_bg_on(nes) && !mask_get_obj_on(nes))
+    {
+        return;
+    }
+
+    const uint8_t sprite_size = ppu_get_sprite_size(nes);
+
+    oam_eval_if_dirty(nes);
+
+    const uint8_t count = nes->ppu.oam_line_count[line];
+
+    if (count > 8)
+    {
+        status_set_obj_overflow(nes, true);
+    }
+
+    // hit needs both layers on and is only set once per frame
+    if (!mask_get_bg_on(nes) || !mask_get_obj_on(nes) || IS_BIT_SET(nes->ppu.status, 6))
+    {
+        return;
+    }
+
+    // if sprite 0 is on the line, it'll always be first in the list
+    if (count == 0 || nes->ppu.oam_line_list[line][0] != 0)
+    {
+        return;
+    }
+
+    const struct Obj sprite = gen_obj(nes, 0, ppu_get_obj_pattern_table_addr(nes), sprite_size);
+
+    const uint16_t pattern_index = sprite_get_pattern_addr(&sprite, line, sprite_size);
+    const uint16_t row = obj_cache_get_row(nes, pattern_index, sprite.a.xflip);
+
+    // fully transparent row can never hit, so skip fetching the bg
+    if (row == 0)
+    {
+        return;
+    }
+
+    struct PriorityBuf prio;
+    struct LineBuf buf;
+    render_scanline_bg_cached(nes, line, &prio, &buf);
+
+    // the leftmost 8 pixels can't hit if either layer is clipped there
+    const uint8_t min_x = (mask_get_bg_leftmost(nes) && mask_get_obj_leftmost(nes)) ? 0 : 8;
+
+    for (uint8_t x = 0; x < 8; ++x)
+    {
+        const uint16_t x_index = sprite.x + x;
+
+        // hit never happens on the last pixel
+        if (x_index >= NES_SCREEN_WIDTH - 1)
+        {
+            break;
+        }
+
+        if (x_index < min_x)
+        {
+            continue;
+        }
+
+        const bool opaque = (row >> (14 - (x * 2))) & 0x3;
+
+        // set if oam[0] is being rendered over pal 1-3 bg.
+        // it does not care for bg priority!
+        if (opaque && prio.pal[x_index] != 0)
+        {
+            // pixel x is output on cycle x + 1
+            nes->ppu.obj_hit_cycle = x_index + 1;
+            break;
+        }
+    }
+}
+
+static FORCE_INLINE void ppu_check_obj_hit(struct NES_Core* nes)
+{
+    if (nes->ppu.obj_hit_cycle >= 0 && nes->ppu.cycles >= nes->ppu.obj_hit_cycle)
+    {
+        status_set_obj_hit(nes, true);
+        nes->ppu.obj_hit_cycle = -1;
+    }
+}
+
+// the tile renderer is only used by the fast backend when rendering on
+// this thread, the dot backend and render threads go line by line.
+static bool ppu_tile_frame_allowed(const struct NES_Core* nes)
+{
+#if NES_THREADS
+    if (nes->render_thread)
+    {
+        return false;
+    }
+#endif
+
+    return nes->ppu_backend == NES_PPU_BACKEND_FAST;
+}
+
+// hands over the list of sprites drawn this frame, in oam order
+static void layers_end_frame(struct NES_Core* nes)
+{
+    struct NES_Layers* layers = nes->layers;
+
+    if (!layers)
+    {
+        return;
+    }
+
+    layers->obj_count = 0;
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        if ((nes->layer_objs_seen >> i) & 1)
+        {
+            layers->objs[layers->obj_count++] = nes->layer_objs[i];
+        }
+    }
+
+    nes->layer_objs_seen = 0;
+}
+
+void nes_ppu_frame_done(struct NES_Core* nes)
+{
+    nes_ppu_tile_flush(nes);
+
+    nes->ppu.tile_frame = ppu_tile_frame_allowed(nes);
+    nes->ppu.tile_start = 0;
+    nes->ppu.tile_end = 0;
+
+#if NES_THREADS
+    // the frame has to be finished before it's handed over,
+    // this also scales it if needed.
+    if (nes->render_thread)
+    {
+        nes_render_thread_end_frame(nes);
+    }
+    else
+#endif
+    {
+        nes_scale_lines(nes, 0, NES_SCREEN_HEIGHT);
+    }
+
+    layers_end_frame(nes);
+    nes_ntsc_end_frame(nes);
+    nes_apu_end_frame(nes);
+
+    nes_publish_frame(nes);
+
+    if (nes->vblank_callback)
+    {
+        nes->vblank_callback(nes->vblank_callback_user);
+    }
+
+    // the diff is only valid for the callback, reset it for the next frame
+    memset(&nes->frame_diff, 0, sizeof(nes->frame_diff));
+
+    // drops back to syncing per instruction once a whole frame goes by
+    // without any raster effects.
+    if (nes->ppu.fine_sync)
+    {
+        --nes->ppu.fine_sync;
     }
 }
 
 // there are 262 scanlines total
 // each scanline takes 341 ppu clock, so ~113 cpu clocks
 // a pixel is created every clock cycle (ppu cycle?)
-void nes_ppu_run(struct NES_Core* nes, const uint16_t cycles_elapsed)
+static void ppu_run(struct NES_Core* nes, uint32_t dots)
 {
-    nes->ppu.cycles += cycles_elapsed * 3;
-
-    if (UNLIKELY(nes->ppu.cycles >= 341))
+    while (dots)
     {
-        if (nes->pixels)
+        // never step past the end of the line
+        const uint32_t line_left = 341 - nes->ppu.cycles;
+        const uint32_t step = dots < line_left ? dots : line_left;
+
+        nes->ppu.cycles += step;
+        dots -= step;
+
+        ppu_check_obj_hit(nes);
+
+        if (nes->ppu.cycles < 341)
         {
-            render_scanline(nes, nes->ppu.scanline);
+            continue;
         }
- 
-        // hack to get games working
-        if (nes->ppu.scanline == 30)
+
+        // when there's no pixels, nothing is rendered (headless).
+        // everything the cpu can see is still done by ppu_eval_line().
+        if (nes->ppu.tile_frame)
         {
-            status_set_obj_hit(nes, 1);
+            // rendered by the tile renderer at vblank
+            if (nes->ppu.scanline >= 0 && nes->ppu.scanline < 240)
+            {
+                nes->ppu.tile_end = nes->ppu.scanline + 1;
+            }
+        }
+        else if (nes->pixels)
+        {
+            ppu_render_line(nes, nes->ppu.scanline);
         }
 
         nes->ppu.cycles -= 341;
         ++nes->ppu.scanline;
 
+        if (nes->ppu.scanline < 240)
+        {
+            ppu_eval_line(nes, nes->ppu.scanline);
+            ppu_check_obj_hit(nes);
+        }
+
         // vblank
-        if (nes->ppu.scanline == 240)
+        else if (nes->ppu.scanline == 240)
         {
-            if (nes->vblank_callback)
-            {
-                nes->vblank_callback(nes->vblank_callback_user);
-            }
+            nes_ppu_frame_done(nes);
 
             // set the status to vblank
             status_set_vblank(nes, true);
@@ -559,7 +1478,111 @@ void nes_ppu_run(struct NES_Core* nes, const uint16_t cycles_elapsed)
     }
 }
 
+// the nmi is the only thing the ppu does that the cpu can see without
+// reading a register, so this is the only event that needs predicting.
+static uint32_t ppu_dots_until_vblank(const struct NES_Core* nes)
+{
+    const int32_t line = nes->ppu.scanline;
+    const int32_t dot = nes->ppu.cycles;
+
+    if (nes->ppu_backend == NES_PPU_BACKEND_DOT)
+    {
+        // vblank is set on dot 1 of line 241. this doesn't know if the
+        // odd frame dot will be skipped, so it may be a dot early.
+        const int32_t pos = ((line + 1) * 341) + dot;
+        const int32_t vblank = ((241 + 1) * 341) + 1;
+
+        if (pos <= vblank)
+        {
+            return vblank - pos;
+        }
+
+        return ((262 * 341) - pos) + vblank;
+    }
+
+    // vblank is set when line 239 finishes
+    if (line < 240)
+    {
+        return ((240 - line) * 341) - dot;
+    }
+
+    // finish this frame, then lines -1 to 239 of the next
+    return ((502 - line) * 341) - dot;
+}
+
+void nes_ppu_sync(struct NES_Core* nes)
+{
+    if (nes->ppu.lag == 0)
+    {
+        return;
+    }
+
+    const uint32_t dots = nes->ppu.lag * 3;
+    nes->ppu.lag = 0;
+
+    if (nes->ppu_backend == NES_PPU_BACKEND_DOT)
+    {
+        nes_ppu_dot_run(nes, dots);
+    }
+    else
+    {
+        ppu_run(nes, dots);
+    }
+
+    // round up to the next cpu cycle, always at least 1 ahead
+    const uint32_t next_event = (ppu_dots_until_vblank(nes) + 2) / 3;
+    nes->ppu.next_event = next_event ? next_event : 1;
+}
+
+void nes_ppu_sync_access(struct NES_Core* nes, bool is_register)
+{
+    if (nes->ppu.fine_sync)
+    {
+        // reads and writes are on the last cycle of the instruction.
+        // the ppu is never run as far as vblank mid instruction though,
+        // as the nmi can only be taken once the instruction is done.
+        const uint32_t access = nes->cpu.cycles ? nes->cpu.cycles - 1 : 0;
+        const uint32_t limit = nes->ppu.next_event - 1 - nes->ppu.lag;
+
+        if (access > nes->ppu.step_synced)
+        {
+            uint32_t cycles = access - nes->ppu.step_synced;
+            cycles = cycles < limit ? cycles : limit;
+
+            nes->ppu.lag += cycles;
+            nes->ppu.step_synced += cycles;
+        }
+    }
+
+    nes_ppu_sync(nes);
+
+    // the pre-render line counts as it reloads the scroll
+    if (is_register && nes->ppu.scanline < 240 && (mask_get_bg_on(nes) || mask_get_obj_on(nes)))
+    {
+        nes->ppu.fine_sync = PPU_FINE_SYNC_FRAMES;
+    }
+}
+
 void nes_ppu_init(struct NES_Core* nes)
 {
-    (void)nes;
+    nes->ppu.obj_hit_cycle = -1;
+    nes->ppu.oam_dirty = true;
+    nes->ppu.lag = 0;
+    nes->ppu.next_event = 0;
+    nes->ppu.fine_sync = 0;
+    nes->ppu.step_synced = 0;
+    nes->ppu.tile_frame = false;
+    nes->ppu.tile_start = 0;
+    nes->ppu.tile_end = 0;
+
+    // gen starts at 1 so that nothing is seen as cached
+    nes->ppu.gen = 1;
+    nes->ppu.chr_gen = 1;
+    memset(nes->ppu.nametable_row_gen, 0, sizeof(nes->ppu.nametable_row_gen));
+    memset(nes->bg_cache.gen, 0, sizeof(nes->bg_cache.gen));
+    memset(nes->obj_cache.gen, 0, sizeof(nes->obj_cache.gen));
+
+    // mark every pixel as changed for the first frame
+    memset(nes->frame_colour, 0xFF, sizeof(nes->frame_colour));
+    memset(&nes->frame_diff, 0, sizeof(nes->frame_diff));
 }
@@ -0,0 +1,157 @@
+#include "nes.h"
+#include "internal.h"
+
+
+// debug views of the ppu state, rendered only when asked for.
+// tiles come from the same decoded pattern rows the sprite renderer
+// uses, so drawing a whole view is mostly table lookups.
+
+static FORCE_INLINE uint16_t debug_bg_pattern_table_addr(const struct NES_Core* nes)
+{
+    return IS_BIT_SET(nes->ppu.ctrl, 4) * 0x1000;
+}
+
+static FORCE_INLINE uint16_t debug_obj_pattern_table_addr(const struct NES_Core* nes)
+{
+    return IS_BIT_SET(nes->ppu.ctrl, 3) * 0x1000;
+}
+
+// the colour of each pram entry, with the current emphasis and greyscale
+// applied, same as the main output.
+static void debug_build_lut(const struct NES_Core* nes, uint32_t lut[32])
+{
+    const uint8_t grey = mask_get_greyscale(nes) ? 0x30 : 0x3F;
+    const uint16_t offset = mask_get_bgr(nes) * 64;
+
+    for (uint8_t i = 0; i < 32; ++i)
+    {
+        uint8_t index = i;
+
+        // 0x10, 0x14, 0x18, 0x1C are mirrors of 0x00, 0x04...
+        if ((index & 0x13) == 0x10)
+        {
+            index -= 0x10;
+        }
+
+        lut[i] = nes->palette[offset + ((nes->ppu.pram[index] & 0x3F) & grey)];
+    }
+}
+
+// draws the 8x8 tile at pattern_addr using palette (0-7).
+// pixel value 0 is drawn as the backdrop.
+static void debug_draw_tile(struct NES_Core* nes, uint32_t* pixels, uint32_t stride, uint16_t pattern_addr, const uint32_t* lut, uint8_t palette, bool xflip, bool yflip)
+{
+    for (uint8_t y = 0; y < 8; ++y)
+    {
+        const uint16_t row = nes_ppu_pattern_row(nes, pattern_addr + (yflip ? 7 - y : y), xflip);
+        uint32_t* p = pixels + stride * y;
+
+        for (uint8_t x = 0; x < 8; ++x)
+        {
+            const uint8_t v = (row >> (14 - (x * 2))) & 0x3;
+
+            p[x] = lut[v ? (palette * 4) + v : 0];
+        }
+    }
+}
+
+static void debug_fill(uint32_t* pixels, uint32_t stride, uint8_t w, uint8_t h, uint32_t colour)
+{
+    for (uint8_t y = 0; y < h; ++y)
+    {
+        for (uint8_t x = 0; x < w; ++x)
+        {
+            pixels[stride * y + x] = colour;
+        }
+    }
+}
+
+void NES_debug_pattern_tables(struct NES_Core* nes, uint32_t* pixels, uint32_t stride, uint8_t palette)
+{
+    uint32_t lut[32];
+    debug_build_lut(nes, lut);
+
+    for (uint16_t tile = 0; tile < 512; ++tile)
+    {
+        // each table is 16x16 tiles, with table 1 to the right of table 0
+        const uint16_t x = ((tile >> 8) * 128) + ((tile & 0xF) * 8);
+        const uint16_t y = ((tile >> 4) & 0xF) * 8;
+
+        debug_draw_tile(nes, pixels + stride * y + x, stride, tile * 16, lut, palette & 0x7, false, false);
+    }
+}
+
+void NES_debug_nametables(struct NES_Core* nes, uint32_t* pixels, uint32_t stride)
+{
+    uint32_t lut[32];
+    debug_build_lut(nes, lut);
+
+    const uint16_t pattern_table_addr = debug_bg_pattern_table_addr(nes);
+
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        // goes through the mirroring, so mirrored tables are the same
+        const uint8_t* nametable = nes->ppu.read_map[0x8 + i];
+        uint32_t* out = pixels + (stride * (i >> 1) * NES_SCREEN_HEIGHT) + ((i & 1) * NES_SCREEN_WIDTH);
+
+        for (uint8_t row = 0; row < 30; ++row)
+        {
+            for (uint8_t col = 0; col < 32; ++col)
+            {
+                const uint8_t tile = nametable[(row * 32) + col];
+                // each attribute byte covers 4x4 tiles, 2 bits per 2x2
+                const uint8_t attr = nametable[0x3C0 + ((row >> 2) * 8) + (col >> 2)];
+                const uint8_t palette = (attr >> (((row & 2) << 1) | (col & 2))) & 0x3;
+
+                debug_draw_tile(nes, out + (stride * row * 8) + (col * 8), stride, pattern_table_addr + (tile * 16), lut, palette, false, false);
+            }
+        }
+    }
+}
+
+void NES_debug_oam(struct NES_Core* nes, uint32_t* pixels, uint32_t stride)
+{
+    uint32_t lut[32];
+    debug_build_lut(nes, lut);
+
+    const bool tall = IS_BIT_SET(nes->ppu.ctrl, 5);
+    const uint16_t pattern_table_addr = debug_obj_pattern_table_addr(nes);
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        const uint8_t n = nes->ppu.oam[(i * 4) + 1];
+        const uint8_t attr = nes->ppu.oam[(i * 4) + 2];
+        const uint8_t palette = 4 + (attr & 0x3);
+        const bool xflip = IS_BIT_SET(attr, 6);
+        const bool yflip = IS_BIT_SET(attr, 7);
+
+        uint32_t* out = pixels + (stride * (i >> 3) * 16) + ((i & 7) * 8);
+
+        if (tall)
+        {
+            // 8x16 sprites pick the table with bit 0, and the bottom
+            // half is drawn on top when flipped.
+            const uint16_t top = ((n & 1) * 0x1000) + ((n & 0xFE) * 16);
+
+            debug_draw_tile(nes, out, stride, top + (yflip ? 16 : 0), lut, palette, xflip, yflip);
+            debug_draw_tile(nes, out + stride * 8, stride, top + (yflip ? 0 : 16), lut, palette, xflip, yflip);
+        }
+        else
+        {
+            debug_draw_tile(nes, out, stride, pattern_table_addr + (n * 16), lut, palette, xflip, yflip);
+            debug_fill(out + stride * 8, stride, 8, 8, lut[0]);
+        }
+    }
+}
+
+void NES_debug_palette(struct NES_Core* nes, uint32_t* pixels, uint32_t stride)
+{
+    uint32_t lut[32];
+    debug_build_lut(nes, lut);
+
+    // bg palettes on the top row, obj palettes on the bottom
+    for (uint8_t i = 0; i < 32; ++i)
+    {
+        debug_fill(pixels + (stride * (i >> 4) * 8) + ((i & 0xF) * 8), stride, 8, 8, lut[i]);
+    }
+}
@@ -0,0 +1,450 @@
+#include "nes.h"
+#include "internal.h"
+
+#include <string.h>
+
+
+// cycle by cycle ppu, this follows what the real ppu does on each dot:
+// https://wiki.nesdev.com/w/index.php/PPU_rendering
+// https://wiki.nesdev.com/w/index.php/PPU_scrolling
+//
+// this is a lot slower than the line renderer in ppu.c, but uses the real
+// fetch pipeline and loopy v / t / x registers, so mid-line changes
+// (scroll splits, palette / chr changes etc) show up where they should.
+// cpu writes still land at the end of each instruction, as the ppu is
+// run after the cpu.
+
+enum
+{
+    DOT_LINE_PRE_RENDER = -1,
+    DOT_LINE_VBLANK = 241,
+    DOT_LINE_LAST = 260,
+    DOTS_PER_LINE = 341,
+};
+
+static FORCE_INLINE bool dot_bg_on(const struct NES_Core* nes)
+{
+    return IS_BIT_SET(nes->ppu.mask, 3);
+}
+
+static FORCE_INLINE bool dot_obj_on(const struct NES_Core* nes)
+{
+    return IS_BIT_SET(nes->ppu.mask, 4);
+}
+
+static FORCE_INLINE bool dot_rendering_on(const struct NES_Core* nes)
+{
+    return dot_bg_on(nes) || dot_obj_on(nes);
+}
+
+static FORCE_INLINE uint8_t dot_bit_reverse(uint8_t v)
+{
+    v = ((v & 0xF0) >> 4) | ((v & 0x0F) << 4);
+    v = ((v & 0xCC) >> 2) | ((v & 0x33) << 2);
+    v = ((v & 0xAA) >> 1) | ((v & 0x55) << 1);
+    return v;
+}
+
+// v: .yyy NN YYYYY XXXXX
+// y = fine y, N = nametable, Y = coarse y, X = coarse x
+static FORCE_INLINE void dot_increment_x(struct NES_Core* nes)
+{
+    uint16_t v = nes->ppu.vram_addr;
+
+    // wrap around to the next horizontal nametable
+    if ((v & 0x001F) == 31)
+    {
+        v &= ~0x001F;
+        v ^= 0x0400;
+    }
+    else
+    {
+        v += 1;
+    }
+
+    nes->ppu.vram_addr = v;
+}
+
+static FORCE_INLINE void dot_increment_y(struct NES_Core* nes)
+{
+    uint16_t v = nes->ppu.vram_addr;
+
+    if ((v & 0x7000) != 0x7000)
+    {
+        v += 0x1000;
+    }
+    else
+    {
+        v &= ~0x7000;
+        uint16_t y = (v & 0x03E0) >> 5;
+
+        // row 29 is the last row, wrap around to the next vertical nametable.
+        // rows 30 / 31 are the attributes, these wrap without switching.
+        if (y == 29)
+        {
+            y = 0;
+            v ^= 0x0800;
+        }
+        else if (y == 31)
+        {
+            y = 0;
+        }
+        else
+        {
+            y += 1;
+        }
+
+        v = (v & ~0x03E0) | (y << 5);
+    }
+
+    nes->ppu.vram_addr = v;
+}
+
+static FORCE_INLINE void dot_copy_x(struct NES_Core* nes)
+{
+    nes->ppu.vram_addr = (nes->ppu.vram_addr & ~0x041F) | (nes->ppu.tmp_addr & 0x041F);
+}
+
+static FORCE_INLINE void dot_copy_y(struct NES_Core* nes)
+{
+    nes->ppu.vram_addr = (nes->ppu.vram_addr & ~0x7BE0) | (nes->ppu.tmp_addr & 0x7BE0);
+}
+
+static FORCE_INLINE void dot_load_bg_shifters(struct NES_PpuDot* d)
+{
+    d->bg_pattern_lo = (d->bg_pattern_lo & 0xFF00) | d->next_pattern_lo;
+    d->bg_pattern_hi = (d->bg_pattern_hi & 0xFF00) | d->next_pattern_hi;
+    // the attribute is the same for all 8 pixels of the tile
+    d->bg_attr_lo = (d->bg_attr_lo & 0xFF00) | ((d->next_attr & 0x1) ? 0xFF : 0x00);
+    d->bg_attr_hi = (d->bg_attr_hi & 0xFF00) | ((d->next_attr & 0x2) ? 0xFF : 0x00);
+}
+
+// each tile takes 8 dots to fetch, 2 dots per read
+static FORCE_INLINE void dot_fetch_bg(struct NES_Core* nes, uint16_t dot)
+{
+    struct NES_PpuDot* d = &nes->ppu.dot;
+    const uint16_t v = nes->ppu.vram_addr;
+    const uint16_t pattern_table = IS_BIT_SET(nes->ppu.ctrl, 4) * 0x1000;
+
+    switch ((dot - 1) & 0x7)
+    {
+        case 0:
+            dot_load_bg_shifters(d);
+            d->next_tile = nes_ppu_read(nes, 0x2000 | (v & 0x0FFF));
+            break;
+
+        case 2: {
+            uint8_t attr = nes_ppu_read(nes, 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+            // select the 2x2 quarter of the 4x4 tile area
+            if (v & 0x0040)
+            {
+                attr >>= 4;
+            }
+            if (v & 0x0002)
+            {
+                attr >>= 2;
+            }
+            d->next_attr = attr & 0x3;
+        } break;
+
+        case 4:
+            d->next_pattern_lo = nes_ppu_read(nes, pattern_table + (d->next_tile * 16) + ((v >> 12) & 0x7) + 0);
+            break;
+
+        case 6:
+            d->next_pattern_hi = nes_ppu_read(nes, pattern_table + (d->next_tile * 16) + ((v >> 12) & 0x7) + 8);
+            break;
+
+        case 7:
+            dot_increment_x(nes);
+            break;
+    }
+}
+
+static FORCE_INLINE void dot_shift(struct NES_Core* nes, uint16_t dot)
+{
+    struct NES_PpuDot* d = &nes->ppu.dot;
+
+    if (dot_bg_on(nes))
+    {
+        d->bg_pattern_lo <<= 1;
+        d->bg_pattern_hi <<= 1;
+        d->bg_attr_lo <<= 1;
+        d->bg_attr_hi <<= 1;
+    }
+
+    // each sprite waits until its x is reached, then shifts out its pixels
+    if (dot_obj_on(nes) && dot <= 257)
+    {
+        for (uint8_t i = 0; i < d->obj_count; ++i)
+        {
+            if (d->obj_x[i] > 0)
+            {
+                d->obj_x[i]--;
+            }
+            else
+            {
+                d->obj_pattern_lo[i] <<= 1;
+                d->obj_pattern_hi[i] <<= 1;
+            }
+        }
+    }
+}
+
+// finds the sprites for the next line, this is done over dots 65-256
+// on real hw, but nothing can see it happening so it's done in one go.
+static void dot_eval_obj(struct NES_Core* nes, int16_t line)
+{
+    struct NES_PpuDot* d = &nes->ppu.dot;
+    const uint8_t sprite_size = IS_BIT_SET(nes->ppu.ctrl, 5) ? 16 : 8;
+    uint8_t count = 0;
+
+    d->obj_count = 0;
+    d->obj_sprite0 = false;
+
+    for (uint8_t i = 0; i < 64; ++i)
+    {
+        const int16_t row = line - nes->ppu.oam[i * 4];
+
+        if (row < 0 || row >= sprite_size)
+        {
+            continue;
+        }
+
+        if (count == 8)
+        {
+            status_set_obj_overflow(nes, true);
+            break;
+        }
+
+        if (i == 0)
+        {
+            d->obj_sprite0 = true;
+        }
+
+        // the pattern is fetched later, so just store the oam index for now
+        d->obj_pattern_lo[count] = i;
+        count++;
+    }
+
+    d->obj_count = count;
+}
+
+// fetches the pattern of each sprite found by dot_eval_obj()
+static void dot_fetch_obj(struct NES_Core* nes, int16_t line)
+{
+    struct NES_PpuDot* d = &nes->ppu.dot;
+    const uint8_t sprite_size = IS_BIT_SET(nes->ppu.ctrl, 5) ? 16 : 8;
+
+    for (uint8_t i = 0; i < d->obj_count; ++i)
+    {
+        const uint8_t* oam = &nes->ppu.oam[d->obj_pattern_lo[i] * 4];
+        const uint8_t attr = oam[2];
+        uint8_t row = line - oam[0];
+        uint16_t addr;
+
+        // flip vertically
+        if (attr & 0x80)
+        {
+            row = (sprite_size - 1) - row;
+        }
+
+        if (sprite_size == 8)
+        {
+            addr = IS_BIT_SET(nes->ppu.ctrl, 3) * 0x1000 + (oam[1] * 16) + row;
+        }
+        else
+        {
+            // bit 0 of the tile selects the table, the bottom half is the next tile
+            addr = ((oam[1] & 0x1) * 0x1000) + ((oam[1] & 0xFE) * 16) + ((row & 0x8) * 2) + (row & 0x7);
+        }
+
+        uint8_t lo = nes_ppu_read(nes, addr + 0);
+        uint8_t hi = nes_ppu_read(nes, addr + 8);
+
+        // flip horizontally
+        if (attr & 0x40)
+        {
+            lo = dot_bit_reverse(lo);
+            hi = dot_bit_reverse(hi);
+        }
+
+        d->obj_x[i] = oam[3];
+        d->obj_attr[i] = attr;
+        d->obj_pattern_lo[i] = lo;
+        d->obj_pattern_hi[i] = hi;
+    }
+}
+
+// muxes the bg and sprite pixel for dot 1-256
+static FORCE_INLINE void dot_output_pixel(struct NES_Core* nes, uint8_t x)
+{
+    struct NES_PpuDot* d = &nes->ppu.dot;
+
+    uint8_t bg_pixel = 0;
+    uint8_t bg_palette = 0;
+
+    if (dot_bg_on(nes) && (x >= 8 || IS_BIT_SET(nes->ppu.mask, 1)))
+    {
+        const uint16_t mux = 0x8000 >> nes->ppu.fine_x;
+
+        bg_pixel = (!!(d->bg_pattern_hi & mux) << 1) | !!(d->bg_pattern_lo & mux);
+        bg_palette = (!!(d->bg_attr_hi & mux) << 1) | !!(d->bg_attr_lo & mux);
+    }
+
+    uint8_t obj_pixel = 0;
+    uint8_t obj_attr = 0;
+    bool obj_sprite0 = false;
+
+    if (dot_obj_on(nes) && (x >= 8 || IS_BIT_SET(nes->ppu.mask, 2)))
+    {
+        // the first non-transparent sprite wins
+        for (uint8_t i = 0; i < d->obj_count; ++i)
+        {
+            if (d->obj_x[i] != 0)
+            {
+                continue;
+            }
+
+            obj_pixel = (!!(d->obj_pattern_hi[i] & 0x80) << 1) | !!(d->obj_pattern_lo[i] & 0x80);
+
+            if (obj_pixel)
+            {
+                obj_attr = d->obj_attr[i];
+                obj_sprite0 = i == 0 && d->obj_sprite0;
+                break;
+            }
+        }
+    }
+
+    uint8_t pram = 0;
+
+    if (bg_pixel && obj_pixel)
+    {
+        // hit never happens on the last pixel
+        if (obj_sprite0 && x != 255)
+        {
+            status_set_obj_hit(nes, true);
+        }
+
+        pram = (obj_attr & 0x20) ? (bg_palette * 4) + bg_pixel : 0x10 + ((obj_attr & 0x3) * 4) + obj_pixel;
+    }
+    else if (obj_pixel)
+    {
+        pram = 0x10 + ((obj_attr & 0x3) * 4) + obj_pixel;
+    }
+    else if (bg_pixel)
+    {
+        pram = (bg_palette * 4) + bg_pixel;
+    }
+
+    d->line[x] = pram;
+}
+
+static FORCE_INLINE void dot_render(struct NES_Core* nes, int16_t line, uint16_t dot)
+{
+    if (line == DOT_LINE_PRE_RENDER && dot == 1)
+    {
+        status_set_vblank(nes, false);
+        status_set_obj_overflow(nes, false);
+        status_set_obj_hit(nes, false);
+    }
+
+    if (dot_rendering_on(nes))
+    {
+        if ((dot >= 2 && dot <= 257) || (dot >= 321 && dot <= 337))
+        {
+            dot_shift(nes, dot);
+            dot_fetch_bg(nes, dot);
+        }
+
+        if (dot == 256)
+        {
+            dot_increment_y(nes);
+        }
+        else if (dot == 257)
+        {
+            dot_load_bg_shifters(&nes->ppu.dot);
+            dot_copy_x(nes);
+
+            // there's no sprites on line 0 as nothing is evaluated on the pre-render line
+            if (line == DOT_LINE_PRE_RENDER)
+            {
+                nes->ppu.dot.obj_count = 0;
+            }
+            else
+            {
+                dot_eval_obj(nes, line);
+            }
+        }
+        else if (dot == 320)
+        {
+            dot_fetch_obj(nes, line);
+        }
+        else if (line == DOT_LINE_PRE_RENDER && dot >= 280 && dot <= 304)
+        {
+            dot_copy_y(nes);
+        }
+    }
+
+    if (line >= 0 && dot >= 1 && dot <= 256)
+    {
+        dot_output_pixel(nes, dot - 1);
+
+        if (dot == 256 && nes->pixels)
+        {
+            nes_ppu_output_line(nes, line, nes->ppu.dot.line);
+        }
+    }
+}
+
+static FORCE_INLINE void dot_step(struct NES_Core* nes)
+{
+    struct NES_Ppu* ppu = &nes->ppu;
+    const int16_t line = ppu->scanline;
+    const uint16_t dot = ppu->cycles;
+
+    if (line < NES_SCREEN_HEIGHT)
+    {
+        dot_render(nes, line, dot);
+    }
+    else if (line == DOT_LINE_VBLANK && dot == 1)
+    {
+        nes_ppu_frame_done(nes);
+
+        status_set_vblank(nes, true);
+
+        if (ctrl_get_nmi(nes))
+        {
+            nes_cpu_nmi(nes);
+        }
+    }
+
+    ppu->cycles++;
+
+    // the last dot of the pre-render line is skipped on odd frames
+    if (line == DOT_LINE_PRE_RENDER && dot == 339 && ppu->dot.odd_frame && dot_rendering_on(nes))
+    {
+        ppu->cycles++;
+    }
+
+    if (ppu->cycles >= DOTS_PER_LINE)
+    {
+        ppu->cycles = 0;
+        ppu->scanline++;
+
+        if (ppu->scanline > DOT_LINE_LAST)
+        {
+            ppu->scanline = DOT_LINE_PRE_RENDER;
+            ppu->dot.odd_frame = !ppu->dot.odd_frame;
+        }
+    }
+}
+
+void nes_ppu_dot_run(struct NES_Core* nes, uint32_t dots)
+{
+    while (dots--)
+    {
+        dot_step(nes);
+    }
+}
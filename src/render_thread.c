@@ -0,0 +1,488 @@
+#include "nes.h"
+#include "internal.h"
+#include "mappers/mappers.h"
+
+#include <string.h>
+#include <assert.h>
+
+
+// rather than rendering each line as the ppu gets to it, the cpu thread
+// logs every change to what the renderer reads, along with a marker for
+// each line. each render worker owns a copy of the ppu, which it brings
+// up to date by replaying the log, rendering lines as it reaches them.
+//
+// this means the cpu thread only has to wait for the workers at vblank,
+// so emulation and rendering overlap.
+//
+// with more than 1 worker, the frame is split into horizontal strips.
+// every worker replays the whole log (so its ppu stays in sync), but
+// only renders the lines of its own strip into nes->pixels.
+
+enum
+{
+    // the log is handed over to the render thread every N lines,
+    // rather than every line, so it isn't constantly woken up.
+    RENDER_PUBLISH_LINES = 16,
+};
+
+// where a chr / nametable ptr points to
+enum RenderSource
+{
+    RENDER_SOURCE_NONE,
+    RENDER_SOURCE_CHR_ROM,
+    RENDER_SOURCE_CHR_RAM,
+    RENDER_SOURCE_VRAM,
+};
+
+static FORCE_INLINE bool is_ptr_in(const uint8_t* ptr, const uint8_t* base, size_t size)
+{
+    return base != NULL && ptr >= base && ptr < base + size;
+}
+
+// ptr's can't be logged as-is as the render thread has its own vram
+// and chr ram, so they're stored as an offset from where they point to.
+static enum RenderSource render_ptr_to_offset(const struct NES_Core* nes, const uint8_t* ptr, uint32_t* offset)
+{
+    if (is_ptr_in(ptr, nes->ppu.vram, sizeof(nes->ppu.vram)))
+    {
+        *offset = ptr - nes->ppu.vram;
+        return RENDER_SOURCE_VRAM;
+    }
+    else if (is_ptr_in(ptr, nes->chr_ram, nes->chr_ram_size))
+    {
+        *offset = ptr - nes->chr_ram;
+        return RENDER_SOURCE_CHR_RAM;
+    }
+    else if (is_ptr_in(ptr, nes->cart.chr_rom, nes->cart.chr_rom_size))
+    {
+        *offset = ptr - nes->cart.chr_rom;
+        return RENDER_SOURCE_CHR_ROM;
+    }
+
+    *offset = 0;
+    return RENDER_SOURCE_NONE;
+}
+
+static uint8_t* render_offset_to_ptr(struct NES_Core* core, enum RenderSource source, uint32_t offset)
+{
+    switch (source)
+    {
+        case RENDER_SOURCE_NONE: return NULL;
+        case RENDER_SOURCE_CHR_ROM: return (uint8_t*)core->cart.chr_rom + offset;
+        case RENDER_SOURCE_CHR_RAM: return core->chr_ram + offset;
+        case RENDER_SOURCE_VRAM: return core->ppu.vram + offset;
+    }
+
+    UNREACHABLE(NULL);
+}
+
+static uint8_t* render_rebase_ptr(const struct NES_Core* nes, struct NES_Core* core, const uint8_t* ptr)
+{
+    uint32_t offset;
+    const enum RenderSource source = render_ptr_to_offset(nes, ptr, &offset);
+
+    // anything else (such as NULL) is left as is
+    if (source == RENDER_SOURCE_NONE)
+    {
+        return (uint8_t*)ptr;
+    }
+
+    return render_offset_to_ptr(core, source, offset);
+}
+
+static void render_replay(struct NES_RenderWorker* worker, const struct NES_RenderEvent* e)
+{
+    struct NES_Core* core = &worker->core;
+
+    switch (e->type)
+    {
+        case RENDER_EVENT_LINE:
+            if (core->pixels && e->addr >= worker->line_start && e->addr < worker->line_end)
+            {
+                nes_ppu_render_line(core, e->addr);
+            }
+            break;
+
+        case RENDER_EVENT_CTRL:
+            if ((core->ppu.ctrl ^ e->value) & 0x20)
+            {
+                core->ppu.oam_dirty = true;
+            }
+            core->ppu.ctrl = e->value;
+            break;
+
+        case RENDER_EVENT_MASK:
+            core->ppu.mask = e->value;
+            break;
+
+        case RENDER_EVENT_SCROLL_X:
+            core->ppu.horizontal_scroll_origin = e->value;
+            break;
+
+        case RENDER_EVENT_SCROLL_Y:
+            core->ppu.vertical_scroll_origin = e->value;
+            break;
+
+        case RENDER_EVENT_PPU_WRITE:
+            nes_ppu_write(core, e->addr, e->value);
+            break;
+
+        case RENDER_EVENT_OAM_WRITE:
+            core->ppu.oam[e->addr & 0xFF] = e->value;
+            core->ppu.oam_dirty = true;
+            break;
+
+        case RENDER_EVENT_PATTERN_TABLE: {
+            uint8_t* ptr = render_offset_to_ptr(core, e->addr, e->data);
+            // chr rom is read only
+            mapper_set_pattern_table(core, e->value, ptr, e->addr == RENDER_SOURCE_CHR_ROM ? NULL : ptr);
+        } break;
+
+        case RENDER_EVENT_NAMETABLE: {
+            uint8_t* ptr = render_offset_to_ptr(core, e->addr, e->data);
+            mapper_set_nametable(core, e->value, ptr, ptr);
+        } break;
+
+        case RENDER_EVENT_SCALE:
+            nes_scale_lines(core, worker->line_start, worker->line_end);
+            break;
+    }
+}
+
+static void* render_thread_func(void* user)
+{
+    struct NES_RenderWorker* worker = user;
+    struct NES_RenderThread* ctx = worker->ctx;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    for (;;)
+    {
+        while (worker->read_pos == ctx->publish_pos && !ctx->quit)
+        {
+            pthread_cond_wait(&ctx->work_cond, &ctx->lock);
+        }
+
+        // everything is replayed before quitting
+        if (worker->read_pos == ctx->publish_pos)
+        {
+            break;
+        }
+
+        const uint32_t start = worker->read_pos;
+        const uint32_t end = ctx->publish_pos;
+
+        pthread_mutex_unlock(&ctx->lock);
+
+        for (uint32_t pos = start; pos != end; ++pos)
+        {
+            render_replay(worker, &ctx->log[pos & (NES_RENDER_LOG_SIZE - 1)]);
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        worker->read_pos = end;
+        pthread_cond_signal(&ctx->idle_cond);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+
+    return NULL;
+}
+
+// returns how far the slowest worker has got, must be called with the lock held.
+static uint32_t render_get_read_pos_locked(const struct NES_RenderThread* ctx)
+{
+    uint32_t read_pos = ctx->workers[0].read_pos;
+
+    for (uint8_t i = 1; i < ctx->worker_count; ++i)
+    {
+        // positions wrap, so compare the distance from the write_pos
+        if (ctx->write_pos - ctx->workers[i].read_pos > ctx->write_pos - read_pos)
+        {
+            read_pos = ctx->workers[i].read_pos;
+        }
+    }
+
+    return read_pos;
+}
+
+// must be called with the lock held
+static void render_publish_locked(struct NES_RenderThread* ctx)
+{
+    if (ctx->publish_pos != ctx->write_pos)
+    {
+        ctx->publish_pos = ctx->write_pos;
+        pthread_cond_broadcast(&ctx->work_cond);
+    }
+
+    ctx->read_pos_cached = render_get_read_pos_locked(ctx);
+}
+
+static void render_publish(struct NES_RenderThread* ctx)
+{
+    pthread_mutex_lock(&ctx->lock);
+    render_publish_locked(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void nes_render_thread_log(struct NES_Core* nes, uint8_t type, uint8_t value, uint16_t addr, uint32_t data)
+{
+    struct NES_RenderThread* ctx = nes->render_thread;
+
+    // if the log is full, wait for the workers to make space.
+    // this only happens if a lot is written in one go, such as
+    // uploading all of chr ram.
+    if (UNLIKELY(ctx->write_pos - ctx->read_pos_cached >= NES_RENDER_LOG_SIZE))
+    {
+        pthread_mutex_lock(&ctx->lock);
+        render_publish_locked(ctx);
+
+        while (ctx->write_pos - ctx->read_pos_cached >= NES_RENDER_LOG_SIZE)
+        {
+            pthread_cond_wait(&ctx->idle_cond, &ctx->lock);
+            ctx->read_pos_cached = render_get_read_pos_locked(ctx);
+        }
+
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    ctx->log[ctx->write_pos & (NES_RENDER_LOG_SIZE - 1)] = (struct NES_RenderEvent)
+    {
+        .data = data,
+        .addr = addr,
+        .type = type,
+        .value = value,
+    };
+
+    ++ctx->write_pos;
+}
+
+void nes_render_thread_log_map(struct NES_Core* nes, uint8_t type, uint8_t table, const uint8_t* ptr)
+{
+    uint32_t offset;
+    const enum RenderSource source = render_ptr_to_offset(nes, ptr, &offset);
+
+    nes_render_thread_log(nes, type, table, source, offset);
+}
+
+void nes_render_thread_log_line(struct NES_Core* nes, uint8_t line)
+{
+    nes_render_thread_log(nes, RENDER_EVENT_LINE, 0, line, 0);
+
+    if ((line % RENDER_PUBLISH_LINES) == RENDER_PUBLISH_LINES - 1)
+    {
+        render_publish(nes->render_thread);
+    }
+}
+
+void nes_render_thread_wait(struct NES_Core* nes)
+{
+    struct NES_RenderThread* ctx = nes->render_thread;
+
+    pthread_mutex_lock(&ctx->lock);
+    render_publish_locked(ctx);
+
+    while (ctx->read_pos_cached != ctx->publish_pos)
+    {
+        pthread_cond_wait(&ctx->idle_cond, &ctx->lock);
+        ctx->read_pos_cached = render_get_read_pos_locked(ctx);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void nes_render_thread_end_frame(struct NES_Core* nes)
+{
+    struct NES_RenderThread* ctx = nes->render_thread;
+
+    nes_render_thread_wait(nes);
+
+    // each worker built the diff for its own lines
+    for (uint8_t i = 0; i < ctx->worker_count; ++i)
+    {
+        struct NES_FrameDiff* diff = &ctx->workers[i].core.frame_diff;
+
+        for (uint8_t j = 0; j < ARRAY_SIZE(diff->rows); ++j)
+        {
+            nes->frame_diff.rows[j] |= diff->rows[j];
+        }
+
+        for (uint8_t j = 0; j < ARRAY_SIZE(diff->tiles); ++j)
+        {
+            nes->frame_diff.tiles[j] |= diff->tiles[j];
+        }
+
+        memset(diff, 0, sizeof(*diff));
+
+        // and its own list of the sprites drawn
+        struct NES_Core* core = &ctx->workers[i].core;
+
+        for (uint8_t j = 0; j < 64; ++j)
+        {
+            if (!((core->layer_objs_seen >> j) & 1))
+            {
+                continue;
+            }
+
+            if ((nes->layer_objs_seen >> j) & 1)
+            {
+                nes->layer_objs[j].rows |= core->layer_objs[j].rows;
+            }
+            else
+            {
+                nes->layer_objs[j] = core->layer_objs[j];
+            }
+        }
+
+        nes->layer_objs_seen |= core->layer_objs_seen;
+        core->layer_objs_seen = 0;
+    }
+
+    // scalers read the lines around each strip, so they can only start
+    // once every strip is done.
+    if (nes->scale.pixels)
+    {
+        nes_render_thread_log(nes, RENDER_EVENT_SCALE, 0, 0, 0);
+        nes_render_thread_wait(nes);
+    }
+}
+
+static void render_worker_init(struct NES_RenderWorker* worker, struct NES_RenderThread* ctx, const struct NES_Core* nes, uint8_t line_start, uint8_t line_end)
+{
+    // the worker starts off with a copy of the current ppu,
+    // with the ptr's moved over to its own vram and chr ram.
+    struct NES_Core* core = &worker->core;
+
+    memcpy(core, nes, sizeof(*core));
+    core->render_thread = NULL;
+    core->vblank_callback = NULL;
+    core->audio_buffer = NULL;
+
+    if (nes->chr_ram)
+    {
+        memcpy(worker->chr_ram, nes->chr_ram, nes->chr_ram_size);
+        core->chr_ram = worker->chr_ram;
+    }
+
+    for (uint8_t i = 0; i < ARRAY_SIZE(core->ppu.read_map); ++i)
+    {
+        core->ppu.read_map[i] = render_rebase_ptr(nes, core, nes->ppu.read_map[i]);
+        core->ppu.write_map[i] = render_rebase_ptr(nes, core, nes->ppu.write_map[i]);
+    }
+
+    worker->ctx = ctx;
+    worker->read_pos = 0;
+    worker->line_start = line_start;
+    worker->line_end = line_end;
+}
+
+// stops the first count workers, draining the log first.
+static void render_stop_workers(struct NES_RenderThread* ctx, uint8_t count)
+{
+    pthread_mutex_lock(&ctx->lock);
+    render_publish_locked(ctx);
+    ctx->quit = true;
+    pthread_cond_broadcast(&ctx->work_cond);
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        pthread_join(ctx->workers[i].thread, NULL);
+    }
+}
+
+bool NES_start_render_thread(struct NES_Core* nes, struct NES_RenderThread* ctx, struct NES_RenderWorker* workers, uint8_t count)
+{
+    if (!nes || !ctx || !workers || !count || count > NES_SCREEN_HEIGHT || nes->render_thread)
+    {
+        return false;
+    }
+
+    if (nes->chr_ram_size > sizeof(workers[0].chr_ram))
+    {
+        NES_log_err("chr ram too big for the render thread\n");
+        return false;
+    }
+
+    // the workers render line by line from here on
+    nes_ppu_tile_stop(nes);
+
+    ctx->workers = workers;
+    ctx->worker_count = count;
+    ctx->write_pos = 0;
+    ctx->read_pos_cached = 0;
+    ctx->publish_pos = 0;
+    ctx->quit = false;
+
+    // split the frame into strips of (about) the same size. these start
+    // on an even line so that yuv420 chroma rows aren't split.
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        const uint8_t line_start = ((NES_SCREEN_HEIGHT / 2) * i / count) * 2;
+        const uint8_t line_end = ((NES_SCREEN_HEIGHT / 2) * (i + 1) / count) * 2;
+
+        render_worker_init(&workers[i], ctx, nes, line_start, line_end);
+    }
+
+    if (pthread_mutex_init(&ctx->lock, NULL))
+    {
+        return false;
+    }
+
+    if (pthread_cond_init(&ctx->work_cond, NULL))
+    {
+        pthread_mutex_destroy(&ctx->lock);
+        return false;
+    }
+
+    if (pthread_cond_init(&ctx->idle_cond, NULL))
+    {
+        pthread_cond_destroy(&ctx->work_cond);
+        pthread_mutex_destroy(&ctx->lock);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        if (pthread_create(&workers[i].thread, NULL, render_thread_func, &workers[i]))
+        {
+            render_stop_workers(ctx, i);
+            pthread_cond_destroy(&ctx->idle_cond);
+            pthread_cond_destroy(&ctx->work_cond);
+            pthread_mutex_destroy(&ctx->lock);
+            return false;
+        }
+    }
+
+    nes->render_thread = ctx;
+
+    return true;
+}
+
+void NES_stop_render_thread(struct NES_Core* nes)
+{
+    struct NES_RenderThread* ctx = nes->render_thread;
+
+    if (!ctx)
+    {
+        return;
+    }
+
+    render_stop_workers(ctx, ctx->worker_count);
+
+    pthread_cond_destroy(&ctx->idle_cond);
+    pthread_cond_destroy(&ctx->work_cond);
+    pthread_mutex_destroy(&ctx->lock);
+
+    // inline rendering carries on from the last frame of the workers
+    for (uint8_t i = 0; i < ctx->worker_count; ++i)
+    {
+        const struct NES_RenderWorker* worker = &ctx->workers[i];
+        const size_t lines = worker->line_end - worker->line_start;
+
+        memcpy(nes->frame_colour[worker->line_start], worker->core.frame_colour[worker->line_start], sizeof(nes->frame_colour[0]) * lines);
+        memcpy(nes->frame_emphasis + worker->line_start, worker->core.frame_emphasis + worker->line_start, lines);
+    }
+
+    nes->render_thread = NULL;
+}
@@ -0,0 +1,553 @@
+#include "nes.h"
+#include "internal.h"
+
+#include <string.h>
+
+#if NES_SSE2
+    #include <emmintrin.h>
+#endif
+
+
+// post process scalers, these run on the finished frame at vblank,
+// reading from nes->pixels and writing to nes->scale.pixels.
+//
+// with render threads, each worker scales its own strip once every
+// strip has been rendered (see nes_render_thread_end_frame()).
+//
+// nearest is done on the raw pixels. the others load each row into
+// 32-bit pixels first, so they work the same for any bpp.
+
+enum
+{
+    // yuv thresholds used by hq2x to decide if 2 colours are different
+    HQ2X_THRESHOLD_Y = 0x30,
+    HQ2X_THRESHOLD_U = 0x07,
+    HQ2X_THRESHOLD_V = 0x06,
+};
+
+// where each channel is in a pixel, used for blending
+struct ScaleChannels
+{
+    uint32_t mask[3];
+    uint8_t shift[3];
+    uint32_t max[3];
+};
+
+static FORCE_INLINE uint8_t scale_get_bytes(uint8_t bpp)
+{
+    switch (bpp)
+    {
+        case 8: return 1;
+        case 15: case 16: return 2;
+        default: return 4;
+    }
+}
+
+static FORCE_INLINE uint8_t* scale_get_row(void* pixels, uint32_t stride, uint8_t bytes, uint16_t y)
+{
+    return (uint8_t*)pixels + ((size_t)stride * y * bytes);
+}
+
+// loads the row into 32-bit pixels, y is clamped to the screen
+static void scale_load_row(uint32_t* out, const struct NES_Core* nes, uint8_t bytes, int16_t y)
+{
+    y = y < 0 ? 0 : y >= NES_SCREEN_HEIGHT ? NES_SCREEN_HEIGHT - 1 : y;
+
+    const uint8_t* row = scale_get_row(nes->pixels, nes->pixels_stride, bytes, y);
+
+    switch (bytes)
+    {
+        case 1:
+            for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+            {
+                out[x] = row[x];
+            }
+            break;
+
+        case 2:
+            for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+            {
+                out[x] = ((const uint16_t*)row)[x];
+            }
+            break;
+
+        case 4:
+            memcpy(out, row, NES_SCREEN_WIDTH * sizeof(uint32_t));
+            break;
+    }
+}
+
+static void scale_store_row(const struct NES_Core* nes, uint8_t bytes, uint16_t y, const uint32_t* in, uint16_t width)
+{
+    uint8_t* row = scale_get_row(nes->scale.pixels, nes->scale.stride, bytes, y);
+
+    switch (bytes)
+    {
+        case 1:
+            for (uint16_t x = 0; x < width; ++x)
+            {
+                row[x] = in[x];
+            }
+            break;
+
+        case 2:
+            for (uint16_t x = 0; x < width; ++x)
+            {
+                ((uint16_t*)row)[x] = in[x];
+            }
+            break;
+
+        case 4:
+            memcpy(row, in, width * sizeof(uint32_t));
+            break;
+    }
+}
+
+#if NES_SSE2
+// doubles each pixel of the row, width * bytes has to be a multiple of 16
+static void scale_row_2x_sse2(uint8_t* out, const uint8_t* in, uint8_t bytes, uint16_t width)
+{
+    for (uint32_t i = 0; i < (uint32_t)width * bytes; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i lo, hi;
+
+        switch (bytes)
+        {
+            case 1:
+                lo = _mm_unpacklo_epi8(v, v);
+                hi = _mm_unpackhi_epi8(v, v);
+                break;
+
+            case 2:
+                lo = _mm_unpacklo_epi16(v, v);
+                hi = _mm_unpackhi_epi16(v, v);
+                break;
+
+            default:
+                lo = _mm_unpacklo_epi32(v, v);
+                hi = _mm_unpackhi_epi32(v, v);
+                break;
+        }
+
+        _mm_storeu_si128((__m128i*)(out + (i * 2) + 0), lo);
+        _mm_storeu_si128((__m128i*)(out + (i * 2) + 16), hi);
+    }
+}
+#endif
+
+static void scale_nearest_row(uint8_t* out, const uint8_t* in, uint8_t bytes, uint8_t scale)
+{
+#if NES_SSE2
+    // 2x and 4x are just doubling (twice)
+    if (scale == 2)
+    {
+        scale_row_2x_sse2(out, in, bytes, NES_SCREEN_WIDTH);
+        return;
+    }
+
+    if (scale == 4)
+    {
+        uint8_t tmp[NES_SCREEN_WIDTH * 2 * sizeof(uint32_t)];
+
+        scale_row_2x_sse2(tmp, in, bytes, NES_SCREEN_WIDTH);
+        scale_row_2x_sse2(out, tmp, bytes, NES_SCREEN_WIDTH * 2);
+        return;
+    }
+#endif
+
+    switch (bytes)
+    {
+        case 1:
+            for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+            {
+                memset(out + (x * scale), in[x], scale);
+            }
+            break;
+
+        case 2:
+            for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+            {
+                for (uint8_t i = 0; i < scale; ++i)
+                {
+                    ((uint16_t*)out)[(x * scale) + i] = ((const uint16_t*)in)[x];
+                }
+            }
+            break;
+
+        case 4:
+            for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+            {
+                for (uint8_t i = 0; i < scale; ++i)
+                {
+                    ((uint32_t*)out)[(x * scale) + i] = ((const uint32_t*)in)[x];
+                }
+            }
+            break;
+    }
+}
+
+static void scale_nearest(const struct NES_Core* nes, uint8_t bytes, uint8_t line_start, uint8_t line_end)
+{
+    const uint8_t scale = nes->scale.factor;
+    const size_t row_size = (size_t)NES_SCREEN_WIDTH * scale * bytes;
+
+    for (uint16_t y = line_start; y < line_end; ++y)
+    {
+        const uint8_t* in = scale_get_row(nes->pixels, nes->pixels_stride, bytes, y);
+        uint8_t* out = scale_get_row(nes->scale.pixels, nes->scale.stride, bytes, y * scale);
+
+        scale_nearest_row(out, in, bytes, scale);
+
+        // the rest of the rows are the same
+        for (uint8_t i = 1; i < scale; ++i)
+        {
+            memcpy(scale_get_row(nes->scale.pixels, nes->scale.stride, bytes, (y * scale) + i), out, row_size);
+        }
+    }
+}
+
+// SOURCE: https://www.scale2x.it/algorithm
+static void scale_scale2x(const struct NES_Core* nes, uint8_t bytes, uint8_t line_start, uint8_t line_end)
+{
+    uint32_t rows[3][NES_SCREEN_WIDTH];
+    uint32_t out[2][NES_SCREEN_WIDTH * 2];
+
+    for (uint16_t y = line_start; y < line_end; ++y)
+    {
+        scale_load_row(rows[0], nes, bytes, y - 1);
+        scale_load_row(rows[1], nes, bytes, y);
+        scale_load_row(rows[2], nes, bytes, y + 1);
+
+        for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+        {
+            const uint16_t left = x ? x - 1 : x;
+            const uint16_t right = x < NES_SCREEN_WIDTH - 1 ? x + 1 : x;
+
+            const uint32_t B = rows[0][x];
+            const uint32_t D = rows[1][left];
+            const uint32_t E = rows[1][x];
+            const uint32_t F = rows[1][right];
+            const uint32_t H = rows[2][x];
+
+            if (B != H && D != F)
+            {
+                out[0][(x * 2) + 0] = D == B ? D : E;
+                out[0][(x * 2) + 1] = B == F ? F : E;
+                out[1][(x * 2) + 0] = D == H ? D : E;
+                out[1][(x * 2) + 1] = H == F ? F : E;
+            }
+            else
+            {
+                out[0][(x * 2) + 0] = out[0][(x * 2) + 1] = E;
+                out[1][(x * 2) + 0] = out[1][(x * 2) + 1] = E;
+            }
+        }
+
+        scale_store_row(nes, bytes, (y * 2) + 0, out[0], NES_SCREEN_WIDTH * 2);
+        scale_store_row(nes, bytes, (y * 2) + 1, out[1], NES_SCREEN_WIDTH * 2);
+    }
+}
+
+// SOURCE: https://www.scale2x.it/algorithm
+static void scale_scale3x(const struct NES_Core* nes, uint8_t bytes, uint8_t line_start, uint8_t line_end)
+{
+    uint32_t rows[3][NES_SCREEN_WIDTH];
+    uint32_t out[3][NES_SCREEN_WIDTH * 3];
+
+    for (uint16_t y = line_start; y < line_end; ++y)
+    {
+        scale_load_row(rows[0], nes, bytes, y - 1);
+        scale_load_row(rows[1], nes, bytes, y);
+        scale_load_row(rows[2], nes, bytes, y + 1);
+
+        for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+        {
+            const uint16_t left = x ? x - 1 : x;
+            const uint16_t right = x < NES_SCREEN_WIDTH - 1 ? x + 1 : x;
+            const uint16_t o = x * 3;
+
+            const uint32_t A = rows[0][left], B = rows[0][x], C = rows[0][right];
+            const uint32_t D = rows[1][left], E = rows[1][x], F = rows[1][right];
+            const uint32_t G = rows[2][left], H = rows[2][x], I = rows[2][right];
+
+            if (B != H && D != F)
+            {
+                out[0][o + 0] = D == B ? D : E;
+                out[0][o + 1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+                out[0][o + 2] = B == F ? F : E;
+                out[1][o + 0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+                out[1][o + 1] = E;
+                out[1][o + 2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+                out[2][o + 0] = D == H ? D : E;
+                out[2][o + 1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+                out[2][o + 2] = H == F ? F : E;
+            }
+            else
+            {
+                for (uint8_t i = 0; i < 3; ++i)
+                {
+                    out[i][o + 0] = out[i][o + 1] = out[i][o + 2] = E;
+                }
+            }
+        }
+
+        for (uint8_t i = 0; i < 3; ++i)
+        {
+            scale_store_row(nes, bytes, (y * 3) + i, out[i], NES_SCREEN_WIDTH * 3);
+        }
+    }
+}
+
+static void scale_get_channels(const struct NES_Core* nes, struct ScaleChannels* c)
+{
+    if (nes->pixel_format == NES_PIXEL_FORMAT_RGB565)
+    {
+        c->mask[0] = 0xF800;
+        c->mask[1] = 0x07E0;
+        c->mask[2] = 0x001F;
+    }
+    else
+    {
+        memcpy(c->mask, nes->palette_mask, sizeof(c->mask));
+    }
+
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        c->shift[i] = 0;
+
+        while (c->mask[i] && !IS_BIT_SET(c->mask[i], c->shift[i]))
+        {
+            ++c->shift[i];
+        }
+
+        c->max[i] = c->mask[i] >> c->shift[i];
+    }
+}
+
+// the same yuv as hq2x, packed as 0x00YYUUVV
+static uint32_t scale_to_yuv(const struct ScaleChannels* c, uint32_t p)
+{
+    int32_t rgb[3];
+
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        rgb[i] = (((p & c->mask[i]) >> c->shift[i]) * 255) / c->max[i];
+    }
+
+    const int32_t y = (rgb[0] + rgb[1] + rgb[2]) >> 2;
+    const int32_t u = 128 + ((rgb[0] - rgb[2]) >> 2);
+    const int32_t v = 128 + ((-rgb[0] + (2 * rgb[1]) - rgb[2]) >> 3);
+
+    return (y << 16) | (u << 8) | v;
+}
+
+static FORCE_INLINE bool scale_yuv_diff(uint32_t a, uint32_t b)
+{
+    const int32_t dy = (int32_t)((a >> 16) & 0xFF) - (int32_t)((b >> 16) & 0xFF);
+    const int32_t du = (int32_t)((a >> 8) & 0xFF) - (int32_t)((b >> 8) & 0xFF);
+    const int32_t dv = (int32_t)((a >> 0) & 0xFF) - (int32_t)((b >> 0) & 0xFF);
+
+    return dy > HQ2X_THRESHOLD_Y || dy < -HQ2X_THRESHOLD_Y ||
+           du > HQ2X_THRESHOLD_U || du < -HQ2X_THRESHOLD_U ||
+           dv > HQ2X_THRESHOLD_V || dv < -HQ2X_THRESHOLD_V;
+}
+
+// (a * wa + b * wb + d * wd) >> shift for each channel, the weights add
+// up to 1 << shift. anything that isn't a channel (alpha) is kept from a.
+static uint32_t scale_blend(const struct ScaleChannels* c, uint32_t a, uint32_t b, uint32_t d, uint8_t wa, uint8_t wb, uint8_t wd, uint8_t shift)
+{
+    uint32_t out = a & ~(c->mask[0] | c->mask[1] | c->mask[2]);
+
+    for (uint8_t i = 0; i < 3; ++i)
+    {
+        const uint32_t m = c->mask[i];
+        const uint64_t sum = ((uint64_t)(a & m) * wa) + ((uint64_t)(b & m) * wb) + ((uint64_t)(d & m) * wd);
+
+        out |= (uint32_t)(sum >> shift) & m;
+    }
+
+    return out;
+}
+
+// works out the corner of e that touches a, b and d. the 4 corners are
+// the same with the neighbours rotated.
+// rather than the 256 entry table of the original, the rules that
+// matter at nes resolution are folded into 2 cases, using the same
+// yuv thresholds and blend weights.
+static FORCE_INLINE uint32_t scale_hq2x_corner(const struct ScaleChannels* c, const uint32_t* p, const uint32_t* yuv, uint8_t e, uint8_t a, uint8_t b, uint8_t d)
+{
+    const bool eb = scale_yuv_diff(yuv[e], yuv[b]);
+    const bool ed = scale_yuv_diff(yuv[e], yuv[d]);
+
+    if (!eb || !ed)
+    {
+        return p[e];
+    }
+
+    // an edge cuts across the corner
+    if (!scale_yuv_diff(yuv[b], yuv[d]))
+    {
+        // round it off more if the corner itself is also filled
+        if (!scale_yuv_diff(yuv[a], yuv[b]))
+        {
+            return scale_blend(c, p[e], p[b], p[d], 2, 3, 3, 3);
+        }
+
+        return scale_blend(c, p[e], p[b], p[d], 2, 1, 1, 2);
+    }
+
+    // a lone pixel, soften it a little
+    return scale_blend(c, p[e], p[b], p[d], 14, 1, 1, 4);
+}
+
+static void scale_hq2x(const struct NES_Core* nes, uint8_t bytes, uint8_t line_start, uint8_t line_end)
+{
+    struct ScaleChannels c;
+    uint32_t rows[3][NES_SCREEN_WIDTH];
+    uint32_t yuv[3][NES_SCREEN_WIDTH];
+    uint32_t out[2][NES_SCREEN_WIDTH * 2];
+
+    scale_get_channels(nes, &c);
+
+    for (uint16_t y = line_start; y < line_end; ++y)
+    {
+        for (uint8_t i = 0; i < 3; ++i)
+        {
+            scale_load_row(rows[i], nes, bytes, y - 1 + i);
+
+            for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+            {
+                yuv[i][x] = scale_to_yuv(&c, rows[i][x]);
+            }
+        }
+
+        for (uint16_t x = 0; x < NES_SCREEN_WIDTH; ++x)
+        {
+            const uint16_t left = x ? x - 1 : x;
+            const uint16_t right = x < NES_SCREEN_WIDTH - 1 ? x + 1 : x;
+
+            // A B C
+            // D E F
+            // G H I
+            enum { A, B, C, D, E, F, G, H, I };
+
+            const uint32_t p[9] =
+            {
+                rows[0][left], rows[0][x], rows[0][right],
+                rows[1][left], rows[1][x], rows[1][right],
+                rows[2][left], rows[2][x], rows[2][right],
+            };
+
+            const uint32_t w[9] =
+            {
+                yuv[0][left], yuv[0][x], yuv[0][right],
+                yuv[1][left], yuv[1][x], yuv[1][right],
+                yuv[2][left], yuv[2][x], yuv[2][right],
+            };
+
+            out[0][(x * 2) + 0] = scale_hq2x_corner(&c, p, w, E, A, B, D);
+            out[0][(x * 2) + 1] = scale_hq2x_corner(&c, p, w, E, C, B, F);
+            out[1][(x * 2) + 0] = scale_hq2x_corner(&c, p, w, E, G, H, D);
+            out[1][(x * 2) + 1] = scale_hq2x_corner(&c, p, w, E, I, H, F);
+        }
+
+        scale_store_row(nes, bytes, (y * 2) + 0, out[0], NES_SCREEN_WIDTH * 2);
+        scale_store_row(nes, bytes, (y * 2) + 1, out[1], NES_SCREEN_WIDTH * 2);
+    }
+}
+
+void nes_scale_lines(const struct NES_Core* nes, uint8_t line_start, uint8_t line_end)
+{
+    if (!nes->scale.pixels || !nes->pixels || nes->pixel_format >= NES_PIXEL_FORMAT_YUV420)
+    {
+        return;
+    }
+
+    // only the lines in the window are scaled
+    line_start = line_start > nes->window.line_start ? line_start : nes->window.line_start;
+    line_end = line_end < nes->window.line_end ? line_end : nes->window.line_end;
+
+    if (line_start >= line_end)
+    {
+        return;
+    }
+
+    const uint8_t bytes = scale_get_bytes(nes->bpp);
+
+    switch (nes->scale.scaler)
+    {
+        case NES_SCALER_NEAREST:
+            scale_nearest(nes, bytes, line_start, line_end);
+            break;
+
+        case NES_SCALER_SCALE2X:
+            scale_scale2x(nes, bytes, line_start, line_end);
+            break;
+
+        case NES_SCALER_SCALE3X:
+            scale_scale3x(nes, bytes, line_start, line_end);
+            break;
+
+        case NES_SCALER_HQ2X:
+            scale_hq2x(nes, bytes, line_start, line_end);
+            break;
+    }
+}
+
+static bool scale_is_valid(const struct NES_Core* nes, enum NES_Scaler scaler, uint8_t scale)
+{
+    switch (scaler)
+    {
+        case NES_SCALER_NEAREST:
+            return scale >= 2 && scale <= 6;
+
+        case NES_SCALER_SCALE2X:
+            return scale == 2;
+
+        case NES_SCALER_SCALE3X:
+            return scale == 3;
+
+        case NES_SCALER_HQ2X:
+            // blending needs to know where each channel is
+            return scale == 2 && (nes->pixel_format == NES_PIXEL_FORMAT_RGB565 ||
+                (nes->palette_mask[0] && nes->palette_mask[1] && nes->palette_mask[2]));
+    }
+
+    return false;
+}
+
+bool NES_set_scaler(struct NES_Core* nes, enum NES_Scaler scaler, uint8_t scale, void* out, uint32_t out_stride)
+{
+    struct NES_Scale config = {0};
+
+    if (out)
+    {
+        if (!scale_is_valid(nes, scaler, scale))
+        {
+            return false;
+        }
+
+        config.pixels = out;
+        config.stride = out_stride;
+        config.scaler = scaler;
+        config.factor = scale;
+    }
+
+    nes->scale = config;
+
+#if NES_THREADS
+    // the workers have to be idle before their copy can be changed
+    if (nes->render_thread)
+    {
+        nes_render_thread_wait(nes);
+
+        for (uint8_t i = 0; i < nes->render_thread->worker_count; ++i)
+        {
+            nes->render_thread->workers[i].core.scale = config;
+        }
+    }
+#endif
+
+    return true;
+}
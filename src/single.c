@@ -4,6 +4,7 @@
 #if NES_SINGLE_FILE
     #include "apu/apu.c"
     #include "apu/apu_io.c"
+    #include "apu/blip.c"
     #include "apu/dmc.c"
     #include "apu/noise.c"
     #include "apu/square1.c"
@@ -14,7 +15,14 @@
     #include "cpu.c"
     #include "joypad.c"
     #include "nes.c"
+    #include "ntsc.c"
     #include "ppu.c"
+    #include "ppu_dot.c"
+    #include "ppu_debug.c"
+    #include "scale.c"
+    #if NES_THREADS
+        #include "render_thread.c"
+    #endif
     #include "mappers/mapper_000.c"
     #include "mappers/mapper_001.c"
     #include "mappers/mapper_002.c"
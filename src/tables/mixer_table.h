@@ -0,0 +1,32 @@
+/* generated: the nes nonlinear mixer, scaled so that both at their max
+ * add up to 32767.
+ * pulse[n] = 95.52 / (8128 / n + 100), n = square1 + square2
+ * tnd[n] = 163.67 / (24329 / n + 100), n = 3 * triangle + 2 * noise + dmc */
+
+#ifndef MIXER_TABLE_H
+#define MIXER_TABLE_H
+
+#include <stdint.h>
+
+static const int16_t MIXER_PULSE_TABLE[31] = {
+	0,380,752,1114,1468,1814,2152,2482,2805,3120,3429,3731,4027,4316,4599,4876,
+	5148,5414,5675,5930,6181,6426,6667,6903,7135,7363,7586,7805,8020,8231,8438,
+};
+
+static const int16_t MIXER_TND_TABLE[203] = {
+	0,220,437,653,867,1080,1291,1500,1707,1913,2117,2320,2521,2720,2918,3115,
+	3309,3503,3695,3885,4074,4261,4448,4632,4816,4997,5178,5357,5535,5712,5887,6061,
+	6234,6406,6576,6745,6913,7080,7245,7409,7573,7735,7895,8055,8214,8371,8528,8683,
+	8838,8991,9143,9294,9444,9593,9742,9889,10035,10180,10324,10467,10610,10751,10892,11031,
+	11170,11308,11444,11580,11715,11850,11983,12116,12247,12378,12508,12637,12766,12893,13020,13146,
+	13271,13396,13519,13642,13765,13886,14007,14127,14246,14364,14482,14599,14716,14831,14946,15061,
+	15175,15288,15400,15512,15623,15733,15843,15952,16060,16168,16275,16382,16488,16594,16698,16803,
+	16906,17009,17112,17214,17315,17416,17516,17616,17715,17814,17912,18009,18106,18203,18299,18394,
+	18489,18583,18677,18771,18863,18956,19048,19139,19230,19321,19411,19500,19589,19678,19766,19853,
+	19941,20027,20114,20200,20285,20370,20455,20539,20623,20706,20789,20871,20953,21035,21116,21197,
+	21277,21357,21437,21516,21595,21674,21752,21829,21907,21984,22060,22136,22212,22288,22363,22438,
+	22512,22586,22660,22733,22806,22879,22951,23023,23095,23166,23237,23307,23378,23448,23517,23587,
+	23656,23724,23793,23861,23929,23996,24063,24130,24197,24263,24329,
+};
+
+#endif /* MIXER_TABLE_H */
@@ -12,6 +12,10 @@ extern "C" {
     #define NES_SINGLE_FILE 0
 #endif
 
+#ifndef NES_THREADS
+    #define NES_THREADS 0
+#endif
+
 #if defined _WIN32 || defined __CYGWIN__
     #ifdef BUILDING_LIB
         #define NESAPI __declspec(dllexport)
@@ -30,6 +34,10 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 
+#if NES_THREADS
+    #include <pthread.h>
+#endif
+
 
 // fwd;
 struct NES_INES;
@@ -39,10 +47,10 @@ struct NES_Cpu;
 struct NES_Ppu;
 struct NES_Cart;
 struct NES_Core;
-struct NES_ApuCallbackData;
+struct NES_RenderThread;
+struct NES_RenderWorker;
 
 
-typedef void(*nes_apu_callback_t)(void* user, struct NES_ApuCallbackData* data);
 typedef void(*nes_vblank_callback_t)(void* user);
 
 
@@ -55,10 +63,37 @@ enum
 
     NES_SCREEN_WIDTH = 256,
     NES_SCREEN_HEIGHT = 240,
+
+    // sizes of the debug views, see NES_debug_pattern_tables() etc.
+    NES_DEBUG_PATTERN_TABLES_WIDTH = 256,
+    NES_DEBUG_PATTERN_TABLES_HEIGHT = 128,
+    NES_DEBUG_NAMETABLES_WIDTH = NES_SCREEN_WIDTH * 2,
+    NES_DEBUG_NAMETABLES_HEIGHT = NES_SCREEN_HEIGHT * 2,
+    NES_DEBUG_OAM_WIDTH = 64,
+    NES_DEBUG_OAM_HEIGHT = 128,
+    NES_DEBUG_PALETTE_WIDTH = 128,
+    NES_DEBUG_PALETTE_HEIGHT = 16,
 };
 
 
 /* APU START */
+enum NES_AudioFormat
+{
+    // signed 16-bit
+    NES_AUDIO_FORMAT_S16,
+    // 32-bit float, -1.0 to 1.0
+    NES_AUDIO_FORMAT_F32,
+};
+
+enum NES_AudioChannel
+{
+    NES_AUDIO_CHANNEL_SQUARE1,
+    NES_AUDIO_CHANNEL_SQUARE2,
+    NES_AUDIO_CHANNEL_TRIANGLE,
+    NES_AUDIO_CHANNEL_NOISE,
+    NES_AUDIO_CHANNEL_COUNT,
+};
+
 struct NES_Square
 {
     uint8_t volume;
@@ -132,12 +167,26 @@ struct NES_FrameSequencer
     int16_t timer;
 };
 
-struct NES_ApuCallbackData
+enum
 {
-    int8_t square1;
-    int8_t square2;
-    int8_t triangle;
-    int8_t noise;
+    // output samples that can be buffered before the frame is read out,
+    // enough for 2 frames at ~240khz
+    NES_BLIP_SIZE = 1024 * 8,
+    // output samples each step is spread over
+    NES_BLIP_TAPS = 16,
+};
+
+struct NES_Blip
+{
+    // output samples per cpu cycle, 32.32 fixed point
+    uint64_t factor;
+    // where the frame starts, within the first sample
+    uint64_t offset;
+    // running sum of the deltas read so far
+    int32_t integrator;
+    // samples that are done and can be read
+    uint32_t avail;
+    int32_t buf[NES_BLIP_SIZE + NES_BLIP_TAPS];
 };
 
 struct NES_Apu
@@ -153,11 +202,151 @@ struct NES_Apu
 
     struct NES_Status status;
     struct NES_FrameSequencer frame_sequencer;
+
+    // cpu cycles that the apu is behind by, it is only run when
+    // something could see it, see nes_apu_sync().
+    uint32_t lag;
 };
     /* APU END */
 
 
     /* PPU START */
+enum NES_PpuBackend
+{
+    // renders a line at a time, fast but no mid-line effects.
+    NES_PPU_BACKEND_FAST,
+    // renders a dot at a time with the real fetch pipeline.
+    NES_PPU_BACKEND_DOT,
+};
+
+enum NES_PixelFormat
+{
+    // colours from NES_set_palette(), see NES_set_pixels().
+    NES_PIXEL_FORMAT_PALETTE,
+    // 16bpp 5:6:5, see NES_set_pixels_rgb565().
+    NES_PIXEL_FORMAT_RGB565,
+    // planar 4:2:0, see NES_set_pixels_yuv420().
+    NES_PIXEL_FORMAT_YUV420,
+    // 32bpp through the ntsc filter, see NES_set_pixels_ntsc().
+    NES_PIXEL_FORMAT_NTSC,
+};
+
+enum
+{
+    // the ntsc filter outputs 2 pixels for each nes pixel
+    NES_NTSC_WIDTH = NES_SCREEN_WIDTH * 2,
+    // number of output pixels each nes pixel adds to
+    NES_NTSC_KERNEL_SIZE = 8,
+};
+
+struct NES_NtscSetup
+{
+    // -100 (soft) to 100 (sharp), 0 is normal. sharper luma lets more of
+    // the colour carrier through, so there's more dot crawl and fringing.
+    int8_t sharpness;
+    // 0-200, 100 is normal.
+    uint8_t saturation;
+    // keeps the carrier at the same phase every frame, so the artifacts
+    // don't crawl.
+    bool no_crawl;
+};
+
+// kernels for the ntsc filter, built by NES_ntsc_init(). this is ~200K
+// so is provided by the caller.
+struct NES_Ntsc
+{
+    // what each colour (emphasis * 64 + colour) adds to the 8 output
+    // pixels around it, for each of the 3 phases a pixel can start at.
+    // b, g, r, unused, each as 0-255 in Q8.
+    int32_t kernel[3][8 * 64][NES_NTSC_KERNEL_SIZE][4];
+    bool no_crawl;
+};
+
+// post process scalers, see NES_set_scaler()
+enum NES_Scaler
+{
+    // integer scale of 2-6
+    NES_SCALER_NEAREST,
+    // edge directed, 2x and 3x
+    NES_SCALER_SCALE2X,
+    NES_SCALER_SCALE3X,
+    // edge directed with blending, 2x
+    NES_SCALER_HQ2X,
+};
+
+// a sprite that was drawn this frame, see NES_set_layers()
+struct NES_LayerObj
+{
+    uint8_t oam_index;
+    uint8_t x;
+    uint8_t y; // line of the top row
+    uint8_t tile; // byte 1 of oam, as is
+    uint8_t palette; // 0-3
+    bool xflip;
+    bool yflip;
+    bool bg_prio; // behind the bg
+    // bit n is set if row n of the sprite was drawn. rows past the 8
+    // sprites per line limit, or outside the render window, are not.
+    uint16_t rows;
+};
+
+// the layers that make up the frame, see NES_set_layers()
+struct NES_Layers
+{
+    // the pram index (0x00-0x1F) of each pixel, 0 being the backdrop in
+    // bg and no sprite in obj. sprites behind the bg are still in obj.
+    uint8_t bg[NES_SCREEN_HEIGHT][NES_SCREEN_WIDTH];
+    uint8_t obj[NES_SCREEN_HEIGHT][NES_SCREEN_WIDTH];
+
+    // the sprites drawn in the last frame, in oam order
+    struct NES_LayerObj objs[64];
+    uint8_t obj_count;
+};
+
+// the part of the screen that is rendered, see NES_set_render_window()
+struct NES_RenderWindow
+{
+    uint16_t x_start; // 0-256, even
+    uint16_t x_end;
+    uint8_t line_start; // 0-240, even
+    uint8_t line_end;
+};
+
+struct NES_Scale
+{
+    void* pixels; // NULL if off
+    uint32_t stride;
+    uint8_t scaler; // enum NES_Scaler
+    uint8_t factor;
+};
+
+// state only used by the dot backend, see ppu_dot.c
+struct NES_PpuDot
+{
+    // bg shift registers, the next tile is loaded into the low byte
+    uint16_t bg_pattern_lo;
+    uint16_t bg_pattern_hi;
+    uint16_t bg_attr_lo;
+    uint16_t bg_attr_hi;
+
+    // fetched during the 8 dots before being loaded into the shifters
+    uint8_t next_tile;
+    uint8_t next_attr;
+    uint8_t next_pattern_lo;
+    uint8_t next_pattern_hi;
+
+    // sprites for the next line, found at the end of the current line
+    uint8_t obj_count;
+    uint8_t obj_x[8];
+    uint8_t obj_attr[8];
+    uint8_t obj_pattern_lo[8];
+    uint8_t obj_pattern_hi[8];
+    bool obj_sprite0; // sprite 0 is in slot 0
+
+    uint8_t line[NES_SCREEN_WIDTH]; // pram index of each pixel
+    bool odd_frame;
+};
+
 struct NES_Ppu
 {
     // these are basically the same, but keep const'ness of pointers
@@ -186,6 +375,12 @@ struct NES_Ppu
     uint8_t write_flipflop;
     bool has_first_8bit;
 
+    // these are the internal "loopy" registers, which the fast backend
+    // doesn't need (it uses the scroll origins above).
+    // vram_addr is v, has_first_8bit is w.
+    uint16_t tmp_addr; // t
+    uint8_t fine_x; // x
+
     // cpu vram reads are buffered, so theres a 1-byte delay
     uint8_t vram_latched_read;
 
@@ -197,9 +392,56 @@ struct NES_Ppu
     int16_t next_cycles;
     int16_t scanline; // -1 - 261
 
+    // the ppu is only run when something could see it, see nes_ppu_sync().
+    // lag is how many cpu cycles it is behind by, it's synced as soon as
+    // lag reaches next_event (the next vblank / nmi).
+    uint32_t lag;
+    uint32_t next_event;
+
+    // while the cpu is touching registers on rendering lines (raster
+    // effects), accesses sync the ppu up to the cycle of the access
+    // rather than the start of the instruction. this is how many frames
+    // that stays on for, see nes_ppu_sync_access().
+    uint8_t fine_sync;
+    // cpu cycles of the current instruction already run by a fine sync
+    uint8_t step_synced;
+
+    // the cycle of the current line that sprite 0 hit will be set on.
+    // this is worked out at the start of each line, -1 if no hit.
+    int16_t obj_hit_cycle;
+
+    // the fast backend puts off rendering the frame until vblank, then
+    // draws the bg as whole tiles. this stops as soon as the ppu is
+    // written to mid frame, see nes_ppu_tile_write().
+    // lines tile_start to tile_end are done but not rendered yet.
+    bool tile_frame;
+    uint8_t tile_start;
+    uint8_t tile_end;
+
     uint8_t pram[32]; /* palette ram */
     uint8_t oam[256]; /* object attribute memory */
+
+    // oam is usually only changed once a frame, so rather than scanning
+    // all 64 sprites on every line, the sprites for each line are found
+    // in one go after oam (or the sprite size) changes.
+    uint8_t oam_line_list[NES_SCREEN_HEIGHT][8]; // oam index, in oam order
+    uint8_t oam_line_count[NES_SCREEN_HEIGHT]; // 0-64, over 8 means overflow
+    bool oam_dirty;
+
     uint8_t vram[1024 * 2]; /* video ram */
+
+    // palette (0-3) of each tile for both vram nametables, expanded from
+    // the attribute bytes as they are written.
+    uint8_t attr_map[2][30][32];
+
+    // write generations, used to tell if the bg of a line has to be
+    // rendered again. gen is bumped on every change, the rest store
+    // the gen of their last change.
+    uint32_t gen;
+    uint32_t chr_gen; // chr ram write or pattern / nametable ptr change
+    uint32_t nametable_row_gen[2][30];
+
+    struct NES_PpuDot dot;
 };
     /* PPU END */
 
@@ -435,6 +677,62 @@ struct NES_Joypad
 struct NES_Palette
 {
     uint32_t colour[64];
+
+    // where each channel is in the colour, used to darken colours for
+    // colour emphasis ($2001 bits 5-7). if these are 0, emphasis does
+    // nothing (such as with 8bpp indexed colours).
+    uint32_t rmask;
+    uint32_t gmask;
+    uint32_t bmask;
+};
+
+// which parts of the screen changed since the previous frame.
+// this is built as the ppu writes pixels and is valid for the
+// duration of the vblank callback (see NES_get_frame_diff()).
+struct NES_FrameDiff
+{
+    // 1-bit per scanline, bit (y & 31) of rows[y >> 5]
+    uint32_t rows[(NES_SCREEN_HEIGHT + 31) / 32];
+    // 1-bit per 8x8 tile, bit (x >> 3) of tiles[y >> 3]
+    uint32_t tiles[NES_SCREEN_HEIGHT / 8];
+};
+
+// the bg of each line from the last frame (as pram indices), along
+// with what it was rendered with.
+// if nothing the line depends on has changed, it's reused as is.
+// the palette isn't part of this as it's applied after.
+struct NES_BgCache
+{
+    uint8_t pram[NES_SCREEN_HEIGHT][NES_SCREEN_WIDTH];
+    uint32_t gen[NES_SCREEN_HEIGHT]; // 0 = nothing cached
+    uint8_t scroll_x[NES_SCREEN_HEIGHT];
+    uint8_t scroll_y[NES_SCREEN_HEIGHT];
+    uint8_t ctrl[NES_SCREEN_HEIGHT];
+};
+
+// 2 or 3 buffers that are rendered into in turn, the finished one is
+// handed over at vblank, see NES_set_pixel_buffers().
+struct NES_PixelBuffers
+{
+    void* buffers[3];
+    uint32_t frame[3]; // frame number of what's in each buffer
+    uint32_t frame_counter;
+
+    // ready / held buffer index and flags, this is shared with the
+    // thread that takes the frames so it's only accessed atomically.
+    uint32_t state;
+
+    uint8_t count; // 0 if not used
+    uint8_t write; // buffer being rendered to
+};
+
+// sprite pattern rows decoded to 2-bit pixels, both as is and flipped
+// horizontally. tiles are decoded when first used after a chr change.
+struct NES_ObjCache
+{
+    // [tile 0-511][row][0 = normal, 1 = xflip], pixel 0 in bits 14-15
+    uint16_t rows[512][8][2];
+    uint32_t gen[512]; // 0 = not cached
 };
 
 struct NES_RomInfo
@@ -452,7 +750,14 @@ struct NES_Core
     struct NES_Ppu ppu;
     struct NES_Joypad jp;
     struct NES_Cart cart;
-    struct NES_Palette palette;
+    // the 64 colours for each of the 8 emphasis states, built by
+    // NES_set_palette(). the emphasis of the line picks the 64 used.
+    uint32_t palette[8 * 64];
+    // the same palette converted for the built in pixel formats.
+    uint16_t palette_rgb565[8 * 64];
+    uint8_t palette_yuv[3][8 * 64];
+    // rgb masks from NES_set_palette()
+    uint32_t palette_mask[3];
     uint8_t wram[1024 * 2];
 
     const uint8_t* rom;
@@ -467,17 +772,120 @@ struct NES_Core
     void* pixels;
     uint32_t pixels_stride;
     uint8_t bpp;
+    uint8_t pixel_format; // enum NES_PixelFormat
+    // the chroma planes for NES_PIXEL_FORMAT_YUV420, pixels is luma.
+    uint8_t* pixels_u;
+    uint8_t* pixels_v;
+    uint32_t pixels_uv_stride;
+    struct NES_PixelBuffers pixel_buffers;
+    struct NES_Scale scale;
+    struct NES_RenderWindow window;
+    // if set, the layers are also written, see NES_set_layers().
+    // the sprites drawn so far this frame are kept by oam index.
+    struct NES_Layers* layers;
+    struct NES_LayerObj layer_objs[64];
+    uint64_t layer_objs_seen;
+    // kernels for NES_PIXEL_FORMAT_NTSC, and the phase of this frame.
+    const struct NES_Ntsc* ntsc;
+    uint8_t ntsc_phase;
+
+    uint8_t ppu_backend; // enum NES_PpuBackend
+
+    // colour (0-63) of each pixel from the last frame, this is compared
+    // against as each line is written in order to build the frame_diff.
+    uint8_t frame_colour[NES_SCREEN_HEIGHT][NES_SCREEN_WIDTH];
+    // emphasis of each line from the last frame, if this changes then
+    // the whole line is marked as changed.
+    uint8_t frame_emphasis[NES_SCREEN_HEIGHT];
+    struct NES_FrameDiff frame_diff;
+
+    struct NES_BgCache bg_cache;
+    struct NES_ObjCache obj_cache;
+
+#if NES_THREADS
+    // if set, lines are rendered on another thread, see render_thread.c
+    struct NES_RenderThread* render_thread;
+#endif
     
     nes_vblank_callback_t vblank_callback;
     void* vblank_callback_user;
 
-    nes_apu_callback_t apu_callback;
-    void* apu_callback_user;
+    // samples are written here as the apu runs, see NES_set_audio_buffer()
+    void* audio_buffer;
+    uint32_t audio_buffer_size;
+    uint32_t audio_count;
+    uint32_t audio_freq;
+    uint8_t audio_format;
+    uint8_t audio_channels;
+    // see NES_set_audio_pan(), 0 being the centre
+    int8_t audio_pan[NES_AUDIO_CHANNEL_COUNT];
+    // if set, left and right are mixed separately using the gains
+    // (256 = full) of each channel.
+    bool audio_panned;
+    uint16_t audio_gain[2][NES_AUDIO_CHANNEL_COUNT];
+    // cpu cycles since the blip frame started
+    uint32_t audio_time;
+    // the mixed output the last delta left each blip buffer at
+    int32_t audio_amp[2];
+    // left (or mono) and right
+    struct NES_Blip blip[2];
+};
+
+#if NES_THREADS
+enum
+{
+    // size of the render log, must be a power of 2
+    NES_RENDER_LOG_SIZE = 1024 * 16,
+};
 
-    uint32_t apu_callback_freq;
-    int32_t apu_callback_counter;
+// a single change to anything the renderer reads (register, vram,
+// oam, chr / nametable ptr), or a line to render.
+struct NES_RenderEvent
+{
+    uint32_t data;
+    uint16_t addr;
+    uint8_t type;
+    uint8_t value;
 };
 
+// renders a strip of lines of each frame on its own thread.
+struct NES_RenderWorker
+{
+    // the ppu as seen by this worker. this lags behind the real
+    // ppu and catches up by replaying the log.
+    struct NES_Core core;
+    uint8_t chr_ram[1024 * 8];
+
+    struct NES_RenderThread* ctx;
+    uint32_t read_pos; // guarded by the lock
+
+    // the lines rendered by this worker, [line_start, line_end)
+    uint8_t line_start;
+    uint8_t line_end;
+
+    pthread_t thread;
+};
+
+// the log shared by all the render workers.
+struct NES_RenderThread
+{
+    struct NES_RenderEvent log[NES_RENDER_LOG_SIZE];
+    uint32_t write_pos; // cpu thread only
+    uint32_t read_pos_cached; // cpu thread only, slowest worker's read_pos
+
+    struct NES_RenderWorker* workers;
+    uint8_t worker_count;
+
+    // these are guarded by the lock
+    uint32_t publish_pos;
+    bool quit;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond; // broadcast when events are published
+    pthread_cond_t idle_cond; // signalled when events are consumed
+};
+#endif
+
 #ifdef __cplusplus
 }
 #endif
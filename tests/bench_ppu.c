@@ -0,0 +1,170 @@
+#include <nes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// runs each rom with both ppu backends, with and without rendering,
+// and prints how long a frame takes.
+// usage: bench_ppu [-f frames] rom...
+
+
+enum
+{
+    DEFAULT_FRAMES = 1200,
+};
+
+
+static struct NES_Core nes = {0};
+static uint8_t ROM[NES_ROM_SIZE_MAX] = {0};
+static uint8_t prg_ram[1024 * 32] = {0};
+static uint8_t chr_ram[1024 * 32] = {0};
+static uint32_t pixels[NES_SCREEN_HEIGHT][NES_SCREEN_WIDTH] = {0};
+
+
+static bool read_file(const char* path, uint8_t* out_buf, size_t* out_size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+    {
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (size <= 0 || size > NES_ROM_SIZE_MAX)
+    {
+        fclose(f);
+        return false;
+    }
+
+    fread(out_buf, 1, size, f);
+    *out_size = (size_t)size;
+    fclose(f);
+
+    return true;
+}
+
+static bool setup(size_t rom_size, enum NES_PpuBackend backend, bool render)
+{
+    struct NES_RomInfo info = {0};
+
+    if (!NES_init(&nes) || !NES_get_rom_info(ROM, rom_size, &info))
+    {
+        return false;
+    }
+
+    if (info.prg_ram_size > sizeof(prg_ram) || info.chr_ram_size > sizeof(chr_ram))
+    {
+        return false;
+    }
+
+    NES_set_prg_ram(&nes, prg_ram, info.prg_ram_size);
+    NES_set_chr_ram(&nes, chr_ram, info.chr_ram_size);
+
+    if (!NES_loadrom(&nes, ROM, rom_size))
+    {
+        return false;
+    }
+
+    NES_set_ppu_backend(&nes, backend);
+    NES_set_pixels(&nes, render ? pixels : NULL, NES_SCREEN_WIDTH, 32);
+
+    return true;
+}
+
+// returns the time per frame in ms, or a negative value on error
+static double bench(size_t rom_size, enum NES_PpuBackend backend, bool render, int frames)
+{
+    if (!setup(rom_size, backend, render))
+    {
+        return -1.0;
+    }
+
+    const clock_t start = clock();
+
+    for (int i = 0; i < frames; ++i)
+    {
+        NES_run_frame(&nes);
+    }
+
+    const clock_t end = clock();
+
+    return ((double)(end - start) * 1000.0 / CLOCKS_PER_SEC) / frames;
+}
+
+int main(int argc, char const *argv[])
+{
+    int frames = DEFAULT_FRAMES;
+    int first_rom = 1;
+
+    if (argc > 2 && !strcmp(argv[1], "-f"))
+    {
+        frames = atoi(argv[2]);
+        first_rom = 3;
+    }
+
+    if (first_rom >= argc || frames <= 0)
+    {
+        printf("usage: %s [-f frames] rom...\n", argv[0]);
+        return -1;
+    }
+
+    static const struct
+    {
+        const char* name;
+        enum NES_PpuBackend backend;
+        bool render;
+    } runs[] =
+    {
+        { "fast headless", NES_PPU_BACKEND_FAST, false },
+        { "fast render", NES_PPU_BACKEND_FAST, true },
+        { "dot headless", NES_PPU_BACKEND_DOT, false },
+        { "dot render", NES_PPU_BACKEND_DOT, true },
+    };
+
+    for (int i = first_rom; i < argc; ++i)
+    {
+        size_t rom_size = 0;
+
+        if (!read_file(argv[i], ROM, &rom_size))
+        {
+            printf("failed to read file %s\n", argv[i]);
+            continue;
+        }
+
+        printf("%s (%d frames)\n", argv[i], frames);
+
+        double fast_ms = 0.0;
+
+        for (size_t j = 0; j < sizeof(runs) / sizeof(runs[0]); ++j)
+        {
+            const double ms = bench(rom_size, runs[j].backend, runs[j].render, frames);
+
+            if (ms < 0.0)
+            {
+                printf("\tfailed to load rom\n");
+                break;
+            }
+
+            if (j == 1)
+            {
+                fast_ms = ms;
+            }
+
+            printf("\t%-14s %8.3f ms/frame %9.1f fps", runs[j].name, ms, ms > 0.0 ? 1000.0 / ms : 0.0);
+
+            // compare rendering with the dot backend against the fast one
+            if (j == 3 && fast_ms > 0.0)
+            {
+                printf(" (%.1fx fast render)", ms / fast_ms);
+            }
+
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
@@ -15,6 +15,7 @@ static struct NES_Core nes = {0};
 static uint8_t ROM[NES_ROM_SIZE_MAX] = {0};
 
 static SDL_AudioDeviceID audio_device = 0;
+static int16_t core_samples[4096] = {0};
 
 
 static bool read_file(const char* path, uint8_t* out_buf, size_t* out_size)
@@ -41,33 +42,19 @@ static bool read_file(const char* path, uint8_t* out_buf, size_t* out_size)
     return true;
 }
 
-static void core_on_apu(void* user, struct NES_ApuCallbackData* data)
+static void queue_audio(uint32_t count)
 {
-    (void)user;
-    
-    // using buffers because pushing 1 sample at a time seems to
-    // cause popping sounds (on my chromebook).
-    static int8_t buffer[SAMPLES] = {0};
-
-    static size_t buffer_count = 0;
+    int16_t samples[sizeof(core_samples) / sizeof(core_samples[0])] = {0};
+    const uint32_t size = count * sizeof(int16_t);
 
-    buffer[buffer_count++] = data->square1 + data->square2 + data->triangle + data->noise;
+    SDL_MixAudioFormat((uint8_t*)samples, (const uint8_t*)core_samples, AUDIO_S16SYS, size, VOLUME);
 
-    if (buffer_count == sizeof(buffer))
+    while (SDL_GetQueuedAudioSize(audio_device) > (SAMPLES * sizeof(int16_t) * 4))
     {
-        buffer_count = 0;
-
-        uint8_t samples[sizeof(buffer)] = {0};
-
-        SDL_MixAudioFormat(samples, (const uint8_t*)buffer, AUDIO_S8, sizeof(buffer), VOLUME);
-
-        while (SDL_GetQueuedAudioSize(audio_device) > (sizeof(buffer) * 4))
-        {
-            SDL_Delay(4);
-        }
-
-        SDL_QueueAudio(audio_device, samples, sizeof(samples));
+        SDL_Delay(4);
     }
+
+    SDL_QueueAudio(audio_device, samples, size);
 }
 
 static void cleanup()
@@ -106,7 +93,7 @@ int main(int argc, char const *argv[])
     const SDL_AudioSpec wanted =
     {
         .freq = SDL_AUDIO_FREQ,
-        .format = AUDIO_S8,
+        .format = AUDIO_S16SYS,
         .channels = 1,
         .silence = 0,
         .samples = SAMPLES,
@@ -143,11 +130,11 @@ int main(int argc, char const *argv[])
         goto fail;
     }
 
-    NES_set_apu_callback(&nes, core_on_apu, NULL, aspec_got.freq);
+    NES_set_audio_buffer(&nes, core_samples, sizeof(core_samples) / sizeof(core_samples[0]), NES_AUDIO_FORMAT_S16, 1, aspec_got.freq);
 
     for (;;)
     {
-        NES_run_frame(&nes);
+        queue_audio(NES_run_frame(&nes));
     }
 
     cleanup();
@@ -75,6 +75,10 @@ static void setup_palette()
         palette.colour[i] = SDL_MapRGB(pixel_format, rgb.r, rgb.g, rgb.b);
     }
 
+    palette.rmask = pixel_format->Rmask;
+    palette.gmask = pixel_format->Gmask;
+    palette.bmask = pixel_format->Bmask;
+
     NES_set_palette(&nes, &palette);
 }
 